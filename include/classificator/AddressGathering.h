@@ -0,0 +1,121 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/04/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_ADDRESSGATHERING_H
+#define DICTAWAV_ADDRESSGATHERING_H
+
+#include <cstdint>
+#include <cstddef>
+#include "X86Dispatch.h"
+
+// _pext_u64 only exists on x86-64
+#if defined(DICTAWAV_X86_DISPATCH) && defined(__x86_64__)
+#define DICTAWAV_PEXT_DISPATCH 1
+#endif
+
+namespace DictaWav {
+
+// Address kernels reading every RAM bit from a packed retina, for retinas too dense for the
+// scatter of their active bits. positions holds ramNumBits retina bits per RAM, in increasing
+// order, shorter RAMs padded with a bit that is never set
+using GatherAddressesFunction =
+    void (*)(const uint64_t* words, const uint32_t* positions, size_t ramsCount, size_t ramNumBits,
+             size_t* addresses);
+
+inline bool getRetinaBit(const uint64_t* words, uint32_t position) {
+  return (words[position / 64] >> (position % 64)) & 1;
+}
+
+// With the bit count known at compile time the inner loop is fully unrolled
+template<size_t RamNumBits>
+inline void gatherAddresses(
+    const uint64_t* words,
+    const uint32_t* positions,
+    size_t ramsCount,
+    size_t,
+    size_t* addresses
+) {
+  for (size_t ram = 0; ram != ramsCount; ++ram, positions += RamNumBits) {
+    size_t address = 0;
+    for (size_t bit = 0; bit != RamNumBits; ++bit)
+      address |= static_cast<size_t>(getRetinaBit(words, positions[bit])) << bit;
+    addresses[ram] = address;
+  }
+}
+
+inline void gatherAddressesGeneric(
+    const uint64_t* words,
+    const uint32_t* positions,
+    size_t ramsCount,
+    size_t ramNumBits,
+    size_t* addresses
+) {
+  for (size_t ram = 0; ram != ramsCount; ++ram, positions += ramNumBits) {
+    size_t address = 0;
+    for (size_t bit = 0; bit != ramNumBits; ++bit)
+      address |= static_cast<size_t>(getRetinaBit(words, positions[bit])) << bit;
+    addresses[ram] = address;
+  }
+}
+
+// Specialized kernels for the usual bit counts, the generic loop for any other
+inline GatherAddressesFunction selectGatherAddresses(size_t ramNumBits) {
+  switch (ramNumBits) {
+    case 8: return gatherAddresses<8>;
+    case 16: return gatherAddresses<16>;
+    case 24: return gatherAddresses<24>;
+    case 32: return gatherAddresses<32>;
+    default: return gatherAddressesGeneric;
+  }
+}
+
+// Retina bits of a RAM that share a word, extracted at once by pext and placed from shift on
+struct AddressSegment {
+  uint32_t word;
+  uint32_t shift;
+  uint64_t mask;
+};
+
+#if defined(DICTAWAV_PEXT_DISPATCH)
+__attribute__((target("bmi2")))
+inline void gatherAddressesPext(
+    const uint64_t* words,
+    const AddressSegment* segments,
+    const uint32_t* segmentOffsets,
+    size_t ramsCount,
+    size_t* addresses
+) {
+  for (size_t ram = 0; ram != ramsCount; ++ram) {
+    size_t address = 0;
+    for (auto segment = segments + segmentOffsets[ram], end = segments + segmentOffsets[ram + 1];
+         segment != end;
+         ++segment)
+      address |= static_cast<size_t>(_pext_u64(words[segment->word], segment->mask))
+          << segment->shift;
+    addresses[ram] = address;
+  }
+}
+#endif
+
+// pext is microcoded, taking hundreds of cycles, on AMD processors before Zen 3, where gathering
+// bit by bit is faster
+inline bool hasFastPext() {
+#if defined(DICTAWAV_PEXT_DISPATCH)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("bmi2")
+      && !__builtin_cpu_is("bdver4")
+      && !__builtin_cpu_is("znver1")
+      && !__builtin_cpu_is("znver2");
+#else
+  return false;
+#endif
+}
+
+}
+
+#endif //DICTAWAV_ADDRESSGATHERING_H
@@ -0,0 +1,292 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/04/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_ADDRESSMAPPING_H
+#define DICTAWAV_ADDRESSMAPPING_H
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include "Retina.h"
+#include "AddressGathering.h"
+
+namespace DictaWav {
+
+// Address of every RAM of a discriminator, the same for all discriminators of a WiSARD
+using RamAddresses = std::vector<size_t>;
+
+// Which retina bits form each RAM address. A WiSARD retina of retinaSize positions is made of
+// retinaReplicas copies of a retinaSize / retinaReplicas bits Retina, one after the other, so
+// position p reads bit p % retinaBitsCount and copies never have to be materialized.
+// Positions are optionally shuffled, then taken ramNumBits at a time. Address bits follow the
+// increasing retina bits a RAM reads, a bit read twice through two replicas counting once.
+// Sparse retinas scatter their active bits through an inverse map listing the RAM address bits
+// each retina bit feeds, untouched RAMs being left at address 0. Denser ones gather every RAM bit
+// from the packed words, with pext where it's fast or a loop specialized on ramNumBits
+class AddressMapping {
+ public:
+  struct AddressBit {
+    uint32_t ram;
+    uint32_t bit;
+  };
+
+ private:
+  size_t retinaSize;
+  size_t retinaBitsCount;
+  size_t ramNumBits;
+  size_t ramsCount;
+
+  // Retina bit of every RAM address bit, RAM after RAM, ramOffsets[ram] being where each one
+  // begins. 32 bits positions halve the mapping size, which is read on every retina
+  std::vector<uint32_t> positions;
+  std::vector<size_t> ramOffsets;
+
+  // Address bits fed by each retina bit, retina bit after retina bit, from inverseOffsets[bit]
+  std::vector<AddressBit> inverseMapping;
+  std::vector<size_t> inverseOffsets;
+
+  // positions with ramNumBits entries for every RAM, padded with retina bit retinaBitsCount
+  std::vector<uint32_t> gatherPositions;
+  GatherAddressesFunction gatherFunction;
+
+  // RAM bits grouped by retina word, from segmentOffsets[ram]
+  std::vector<AddressSegment> segments;
+  std::vector<uint32_t> segmentOffsets;
+  bool usePext;
+
+  // Retinas with fewer active bits than this are scattered, denser ones are gathered
+  size_t scatterThreshold;
+
+ public:
+  AddressMapping(
+      size_t retinaSize,
+      size_t ramNumBits,
+      bool randomizePositions = true,
+      size_t retinaReplicas = 1
+  ) :
+      retinaSize(retinaSize),
+      retinaBitsCount(retinaReplicas != 0 ? retinaSize / retinaReplicas : 0),
+      ramNumBits(ramNumBits),
+      ramsCount(
+          static_cast<size_t>(std::ceil(
+              static_cast<double>(retinaSize) / static_cast<double>(ramNumBits)))
+      ),
+      gatherFunction(selectGatherAddresses(ramNumBits)),
+      usePext(hasFastPext()),
+      // Measured crossovers, on 2048 bits retinas with and without replicas
+      scatterThreshold(this->usePext ? this->retinaBitsCount / 3 : this->retinaBitsCount * 2 / 3) {
+    if (ramNumBits > 62)
+      throw std::runtime_error(
+          "WiSARD ERROR: Representation overflow due to number of bits being greater than 62."
+      );
+
+    if (retinaReplicas == 0 || retinaSize % retinaReplicas != 0)
+      throw std::runtime_error(
+          "WiSARD ERROR: Retina size must be a multiple of the number of retina replicas."
+      );
+
+    std::vector<size_t> retinaPositions(retinaSize);
+    for (size_t index = 0; index != retinaSize; ++index)
+      retinaPositions[index] = index;
+
+    if (randomizePositions)
+      std::shuffle(
+          retinaPositions.begin(),
+          retinaPositions.end(),
+          std::mt19937(std::random_device()())
+      );
+
+    this->positions.reserve(retinaSize);
+    this->ramOffsets.reserve(this->ramsCount + 1);
+
+    size_t fullRamsCount = retinaSize / ramNumBits;
+    for (size_t ram = 0; ram != fullRamsCount; ++ram) {
+      this->ramOffsets.push_back(this->positions.size());
+      for (size_t bit = 0; bit != ramNumBits; ++bit)
+        this->addPosition(retinaPositions[ram * ramNumBits + bit]);
+    }
+
+    // The rest of the retina when retina's length isn't a multiple of bit's address number. It
+    // starts one position before the last full RAM ends, as WiSARD always did
+    size_t restOfPositions = retinaSize % ramNumBits;
+    if (restOfPositions != 0) {
+      size_t first = fullRamsCount != 0 ? retinaSize - restOfPositions - 1 : 0;
+      this->ramOffsets.push_back(this->positions.size());
+      for (size_t bit = 0; bit != restOfPositions; ++bit)
+        this->addPosition(retinaPositions[first + bit]);
+    }
+
+    this->ramOffsets.push_back(this->positions.size());
+    this->sortRamPositions();
+    this->buildInverseMapping();
+    this->buildGatherPositions();
+    this->buildSegments();
+  }
+
+  size_t getRetinaSize() const { return this->retinaSize; }
+
+  // Bits count of the Retinas this mapping reads
+  size_t getRetinaBitsCount() const { return this->retinaBitsCount; }
+
+  size_t getRamNumBits() const { return this->ramNumBits; }
+
+  size_t getRamsCount() const { return this->ramsCount; }
+
+  size_t getRamBitsCount(size_t ram) const {
+    return this->ramOffsets[ram + 1] - this->ramOffsets[ram];
+  }
+
+  const uint32_t* getRamPositions(size_t ram) const {
+    return this->positions.data() + this->ramOffsets[ram];
+  }
+
+  RamAddresses computeAddresses(const Retina& retina) const {
+    RamAddresses addresses(this->ramsCount);
+    this->computeAddresses(retina, addresses.data());
+    return addresses;
+  }
+
+  // Writes getRamsCount() addresses
+  void computeAddresses(const Retina& retina, size_t* addresses) const {
+    if (retina.getActiveBits().size() < this->scatterThreshold)
+      this->scatterAddresses(retina, addresses);
+    else
+      this->gatherAddresses(retina, addresses);
+  }
+
+  // On time proportional to the retina active bits
+  void scatterAddresses(const Retina& retina, size_t* addresses) const {
+    std::fill(addresses, addresses + this->ramsCount, size_t(0));
+
+    for (auto retinaBit : retina.getActiveBits())
+      for (auto addressBit = this->inverseMapping.data() + this->inverseOffsets[retinaBit],
+               end = this->inverseMapping.data() + this->inverseOffsets[retinaBit + 1];
+           addressBit != end;
+           ++addressBit)
+        addresses[addressBit->ram] |= size_t(1) << addressBit->bit;
+  }
+
+  // On time proportional to the retina size
+  void gatherAddresses(const Retina& retina, size_t* addresses) const {
+#if defined(DICTAWAV_PEXT_DISPATCH)
+    if (this->usePext) {
+      gatherAddressesPext(
+          retina.getWords().data(),
+          this->segments.data(),
+          this->segmentOffsets.data(),
+          this->ramsCount,
+          addresses
+      );
+      return;
+    }
+#endif
+    this->gatherFunction(
+        retina.getWords().data(),
+        this->gatherPositions.data(),
+        this->ramsCount,
+        this->ramNumBits,
+        addresses
+    );
+  }
+
+  void checkAddresses(const RamAddresses& addresses) const {
+    if (addresses.size() != this->ramsCount)
+      throw std::runtime_error(
+          "WiSARD ERROR: Got " + std::to_string(addresses.size())
+              + " addresses, expected " + std::to_string(this->ramsCount) + "."
+      );
+  }
+
+  void checkRetina(const Retina& retina) const {
+    if (retina.getBitsCount() != this->retinaBitsCount)
+      throw std::runtime_error(
+          "WiSARD ERROR: Retina has " + std::to_string(retina.getBitsCount())
+              + " bits, expected " + std::to_string(this->retinaBitsCount) + "."
+      );
+  }
+
+ private:
+  void addPosition(size_t retinaPosition) {
+    this->positions.push_back(static_cast<uint32_t>(retinaPosition % this->retinaBitsCount));
+  }
+
+  // Every RAM reads its retina bits in increasing order, each one once
+  void sortRamPositions() {
+    std::vector<uint32_t> sortedPositions;
+    sortedPositions.reserve(this->positions.size());
+    for (size_t ram = 0; ram != this->ramsCount; ++ram) {
+      auto first = sortedPositions.size();
+      sortedPositions.insert(
+          sortedPositions.end(),
+          this->positions.begin() + this->ramOffsets[ram],
+          this->positions.begin() + this->ramOffsets[ram + 1]
+      );
+      std::sort(sortedPositions.begin() + first, sortedPositions.end());
+      sortedPositions.erase(
+          std::unique(sortedPositions.begin() + first, sortedPositions.end()),
+          sortedPositions.end()
+      );
+      this->ramOffsets[ram] = first;
+    }
+    this->ramOffsets[this->ramsCount] = sortedPositions.size();
+    this->positions = std::move(sortedPositions);
+  }
+
+  // Counting sort of every (ram, bit) by the retina bit it reads
+  void buildInverseMapping() {
+    this->inverseOffsets.assign(this->retinaBitsCount + 1, 0);
+    for (auto position : this->positions)
+      ++this->inverseOffsets[position + 1];
+    for (size_t bit = 0; bit != this->retinaBitsCount; ++bit)
+      this->inverseOffsets[bit + 1] += this->inverseOffsets[bit];
+
+    std::vector<size_t> nextEntry(this->inverseOffsets.begin(), this->inverseOffsets.end() - 1);
+    this->inverseMapping.resize(this->positions.size());
+    for (size_t ram = 0; ram != this->ramsCount; ++ram)
+      for (size_t bit = 0; bit != this->getRamBitsCount(ram); ++bit)
+        this->inverseMapping[nextEntry[this->getRamPositions(ram)[bit]]++] =
+            AddressBit{static_cast<uint32_t>(ram), static_cast<uint32_t>(bit)};
+  }
+
+  void buildGatherPositions() {
+    this->gatherPositions.assign(
+        this->ramsCount * this->ramNumBits,
+        static_cast<uint32_t>(this->retinaBitsCount)
+    );
+    for (size_t ram = 0; ram != this->ramsCount; ++ram)
+      std::copy(
+          this->getRamPositions(ram),
+          this->getRamPositions(ram) + this->getRamBitsCount(ram),
+          this->gatherPositions.begin() + ram * this->ramNumBits
+      );
+  }
+
+  void buildSegments() {
+    this->segmentOffsets.reserve(this->ramsCount + 1);
+    for (size_t ram = 0; ram != this->ramsCount; ++ram) {
+      this->segmentOffsets.push_back(static_cast<uint32_t>(this->segments.size()));
+      for (size_t bit = 0; bit != this->getRamBitsCount(ram); ++bit) {
+        auto position = this->getRamPositions(ram)[bit];
+        auto word = static_cast<uint32_t>(position / 64);
+        if (this->segments.size() == this->segmentOffsets.back()
+            || this->segments.back().word != word)
+          this->segments.push_back(AddressSegment{word, static_cast<uint32_t>(bit), 0});
+        this->segments.back().mask |= uint64_t(1) << (position % 64);
+      }
+    }
+    this->segmentOffsets.push_back(static_cast<uint32_t>(this->segments.size()));
+  }
+};
+
+}
+
+#endif //DICTAWAV_ADDRESSMAPPING_H
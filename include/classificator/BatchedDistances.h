@@ -0,0 +1,425 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTA_BATCHEDDISTANCES_H
+#define DICTA_BATCHEDDISTANCES_H
+
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+#include "X86Dispatch.h"
+
+namespace DictaWav {
+
+// Nearest kernels of many frames at once. Squared distances are expanded as
+// ||frame||^2 - 2 frame.kernel + ||kernel||^2, and as ||frame||^2 doesn't change which kernel is
+// nearest only the score ||kernel||^2 - 2 frame.kernel is computed. Frame times kernel products
+// are one matrix multiplication, done by a microkernel over frameRowsPerBlock frames and
+// kernelsPerPanel kernels held on registers, which also takes the argmin before leaving them
+
+static constexpr size_t frameRowsPerBlock = 4;
+static constexpr size_t kernelsPerPanel = 16;
+// Frames kept on cache while every kernel panel goes through them
+static constexpr size_t framesPerCacheBlock = 64;
+
+// Scores frameRowsPerBlock rows against the kernelsPerPanel kernels starting at panel, a
+// coordinate major matrix with stride values per coordinate, updating each row nearest score and
+// index where a kernel beats it. Kernel norms of padding kernels must be infinite
+template<typename Sample>
+using PanelNearestFunction =
+    void (*)(const Sample* const* rows, size_t dimension, const Sample* panel, size_t stride,
+             const Sample* norms, size_t firstKernel, Sample* nearestScores,
+             size_t* nearestIndices);
+
+// Scans a panel scores in order, so ties keep the lowest index
+template<typename Sample>
+inline void updateNearest(
+    const Sample* scores,
+    size_t firstKernel,
+    Sample& nearestScore,
+    size_t& nearestIndex
+) {
+  for (size_t lane = 0; lane != kernelsPerPanel; ++lane)
+    if (scores[lane] < nearestScore) {
+      nearestScore = scores[lane];
+      nearestIndex = firstKernel + lane;
+    }
+}
+
+template<typename Sample>
+inline void panelNearestScalar(
+    const Sample* const* rows,
+    size_t dimension,
+    const Sample* panel,
+    size_t stride,
+    const Sample* norms,
+    size_t firstKernel,
+    Sample* nearestScores,
+    size_t* nearestIndices
+) {
+  Sample sums[frameRowsPerBlock][kernelsPerPanel] = {};
+
+  for (size_t coordinate = 0; coordinate != dimension; ++coordinate, panel += stride)
+    for (size_t row = 0; row != frameRowsPerBlock; ++row) {
+      Sample value = rows[row][coordinate];
+      for (size_t lane = 0; lane != kernelsPerPanel; ++lane)
+        sums[row][lane] += value * panel[lane];
+    }
+
+  for (size_t row = 0; row != frameRowsPerBlock; ++row) {
+    for (size_t lane = 0; lane != kernelsPerPanel; ++lane)
+      sums[row][lane] = norms[lane] - Sample(2) * sums[row][lane];
+    updateNearest(sums[row], firstKernel, nearestScores[row], nearestIndices[row]);
+  }
+}
+
+#if defined(DICTAWAV_X86_DISPATCH)
+// Microkernels below are written for four rows, with every sum on its own register
+static_assert(frameRowsPerBlock == 4, "SIMD microkernels take four rows at a time");
+
+// Scores are only stored and scanned when one of them beats the row nearest score, which after
+// the first panels is rare
+__attribute__((target("avx2,fma")))
+inline void updateNearestAvx2(
+    __m256d norms0, __m256d norms1, __m256d norms2, __m256d norms3,
+    __m256d sums0, __m256d sums1, __m256d sums2, __m256d sums3,
+    size_t firstKernel, double& nearestScore, size_t& nearestIndex
+) {
+  const __m256d minusTwo = _mm256_set1_pd(-2.0);
+  __m256d scores0 = _mm256_fmadd_pd(minusTwo, sums0, norms0);
+  __m256d scores1 = _mm256_fmadd_pd(minusTwo, sums1, norms1);
+  __m256d scores2 = _mm256_fmadd_pd(minusTwo, sums2, norms2);
+  __m256d scores3 = _mm256_fmadd_pd(minusTwo, sums3, norms3);
+
+  __m256d nearest = _mm256_set1_pd(nearestScore);
+  __m256d lower = _mm256_or_pd(
+      _mm256_or_pd(_mm256_cmp_pd(scores0, nearest, _CMP_LT_OQ),
+                   _mm256_cmp_pd(scores1, nearest, _CMP_LT_OQ)),
+      _mm256_or_pd(_mm256_cmp_pd(scores2, nearest, _CMP_LT_OQ),
+                   _mm256_cmp_pd(scores3, nearest, _CMP_LT_OQ)));
+  if (_mm256_movemask_pd(lower) == 0)
+    return;
+
+  double scores[kernelsPerPanel];
+  _mm256_storeu_pd(scores, scores0);
+  _mm256_storeu_pd(scores + 4, scores1);
+  _mm256_storeu_pd(scores + 8, scores2);
+  _mm256_storeu_pd(scores + 12, scores3);
+  updateNearest(scores, firstKernel, nearestScore, nearestIndex);
+}
+
+__attribute__((target("avx2,fma")))
+inline void panelNearestAvx2(
+    const double* const* rows,
+    size_t dimension,
+    const double* panel,
+    size_t stride,
+    const double* norms,
+    size_t firstKernel,
+    double* nearestScores,
+    size_t* nearestIndices
+) {
+  const double* row0 = rows[0];
+  const double* row1 = rows[1];
+  const double* row2 = rows[2];
+  const double* row3 = rows[3];
+  // 16 doubles are four registers, so the panel is done in two halves to stay within 16 registers
+  __m256d halfSums[2][frameRowsPerBlock][2];
+
+  for (size_t half = 0; half != 2; ++half) {
+    __m256d sum00 = _mm256_setzero_pd(), sum01 = _mm256_setzero_pd();
+    __m256d sum10 = _mm256_setzero_pd(), sum11 = _mm256_setzero_pd();
+    __m256d sum20 = _mm256_setzero_pd(), sum21 = _mm256_setzero_pd();
+    __m256d sum30 = _mm256_setzero_pd(), sum31 = _mm256_setzero_pd();
+
+    const double* column = panel + half * 8;
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride) {
+      __m256d kernels0 = _mm256_load_pd(column);
+      __m256d kernels1 = _mm256_load_pd(column + 4);
+      __m256d value = _mm256_broadcast_sd(row0 + coordinate);
+      sum00 = _mm256_fmadd_pd(value, kernels0, sum00);
+      sum01 = _mm256_fmadd_pd(value, kernels1, sum01);
+      value = _mm256_broadcast_sd(row1 + coordinate);
+      sum10 = _mm256_fmadd_pd(value, kernels0, sum10);
+      sum11 = _mm256_fmadd_pd(value, kernels1, sum11);
+      value = _mm256_broadcast_sd(row2 + coordinate);
+      sum20 = _mm256_fmadd_pd(value, kernels0, sum20);
+      sum21 = _mm256_fmadd_pd(value, kernels1, sum21);
+      value = _mm256_broadcast_sd(row3 + coordinate);
+      sum30 = _mm256_fmadd_pd(value, kernels0, sum30);
+      sum31 = _mm256_fmadd_pd(value, kernels1, sum31);
+    }
+
+    halfSums[half][0][0] = sum00, halfSums[half][0][1] = sum01;
+    halfSums[half][1][0] = sum10, halfSums[half][1][1] = sum11;
+    halfSums[half][2][0] = sum20, halfSums[half][2][1] = sum21;
+    halfSums[half][3][0] = sum30, halfSums[half][3][1] = sum31;
+  }
+
+  __m256d norms0 = _mm256_loadu_pd(norms);
+  __m256d norms1 = _mm256_loadu_pd(norms + 4);
+  __m256d norms2 = _mm256_loadu_pd(norms + 8);
+  __m256d norms3 = _mm256_loadu_pd(norms + 12);
+  for (size_t row = 0; row != frameRowsPerBlock; ++row)
+    updateNearestAvx2(norms0, norms1, norms2, norms3,
+                      halfSums[0][row][0], halfSums[0][row][1],
+                      halfSums[1][row][0], halfSums[1][row][1],
+                      firstKernel, nearestScores[row], nearestIndices[row]);
+}
+
+__attribute__((target("avx2,fma")))
+inline void updateNearestAvx2(
+    __m256 norms0, __m256 norms1, __m256 sums0, __m256 sums1,
+    size_t firstKernel, float& nearestScore, size_t& nearestIndex
+) {
+  const __m256 minusTwo = _mm256_set1_ps(-2.0f);
+  __m256 scores0 = _mm256_fmadd_ps(minusTwo, sums0, norms0);
+  __m256 scores1 = _mm256_fmadd_ps(minusTwo, sums1, norms1);
+
+  __m256 nearest = _mm256_set1_ps(nearestScore);
+  __m256 lower = _mm256_or_ps(_mm256_cmp_ps(scores0, nearest, _CMP_LT_OQ),
+                              _mm256_cmp_ps(scores1, nearest, _CMP_LT_OQ));
+  if (_mm256_movemask_ps(lower) == 0)
+    return;
+
+  float scores[kernelsPerPanel];
+  _mm256_storeu_ps(scores, scores0);
+  _mm256_storeu_ps(scores + 8, scores1);
+  updateNearest(scores, firstKernel, nearestScore, nearestIndex);
+}
+
+__attribute__((target("avx2,fma")))
+inline void panelNearestAvx2(
+    const float* const* rows,
+    size_t dimension,
+    const float* panel,
+    size_t stride,
+    const float* norms,
+    size_t firstKernel,
+    float* nearestScores,
+    size_t* nearestIndices
+) {
+  const float* row0 = rows[0];
+  const float* row1 = rows[1];
+  const float* row2 = rows[2];
+  const float* row3 = rows[3];
+
+  __m256 sum00 = _mm256_setzero_ps(), sum01 = _mm256_setzero_ps();
+  __m256 sum10 = _mm256_setzero_ps(), sum11 = _mm256_setzero_ps();
+  __m256 sum20 = _mm256_setzero_ps(), sum21 = _mm256_setzero_ps();
+  __m256 sum30 = _mm256_setzero_ps(), sum31 = _mm256_setzero_ps();
+
+  for (size_t coordinate = 0; coordinate != dimension; ++coordinate, panel += stride) {
+    __m256 kernels0 = _mm256_load_ps(panel);
+    __m256 kernels1 = _mm256_load_ps(panel + 8);
+    __m256 value = _mm256_broadcast_ss(row0 + coordinate);
+    sum00 = _mm256_fmadd_ps(value, kernels0, sum00);
+    sum01 = _mm256_fmadd_ps(value, kernels1, sum01);
+    value = _mm256_broadcast_ss(row1 + coordinate);
+    sum10 = _mm256_fmadd_ps(value, kernels0, sum10);
+    sum11 = _mm256_fmadd_ps(value, kernels1, sum11);
+    value = _mm256_broadcast_ss(row2 + coordinate);
+    sum20 = _mm256_fmadd_ps(value, kernels0, sum20);
+    sum21 = _mm256_fmadd_ps(value, kernels1, sum21);
+    value = _mm256_broadcast_ss(row3 + coordinate);
+    sum30 = _mm256_fmadd_ps(value, kernels0, sum30);
+    sum31 = _mm256_fmadd_ps(value, kernels1, sum31);
+  }
+
+  __m256 norms0 = _mm256_loadu_ps(norms);
+  __m256 norms1 = _mm256_loadu_ps(norms + 8);
+  updateNearestAvx2(norms0, norms1, sum00, sum01, firstKernel, nearestScores[0], nearestIndices[0]);
+  updateNearestAvx2(norms0, norms1, sum10, sum11, firstKernel, nearestScores[1], nearestIndices[1]);
+  updateNearestAvx2(norms0, norms1, sum20, sum21, firstKernel, nearestScores[2], nearestIndices[2]);
+  updateNearestAvx2(norms0, norms1, sum30, sum31, firstKernel, nearestScores[3], nearestIndices[3]);
+}
+
+__attribute__((target("avx512f")))
+inline void updateNearestAvx512(
+    __m512d norms0, __m512d norms1, __m512d sums0, __m512d sums1,
+    size_t firstKernel, double& nearestScore, size_t& nearestIndex
+) {
+  const __m512d minusTwo = _mm512_set1_pd(-2.0);
+  __m512d scores0 = _mm512_fmadd_pd(minusTwo, sums0, norms0);
+  __m512d scores1 = _mm512_fmadd_pd(minusTwo, sums1, norms1);
+
+  __m512d nearest = _mm512_set1_pd(nearestScore);
+  if ((_mm512_cmp_pd_mask(scores0, nearest, _CMP_LT_OQ)
+      | _mm512_cmp_pd_mask(scores1, nearest, _CMP_LT_OQ)) == 0)
+    return;
+
+  double scores[kernelsPerPanel];
+  _mm512_storeu_pd(scores, scores0);
+  _mm512_storeu_pd(scores + 8, scores1);
+  updateNearest(scores, firstKernel, nearestScore, nearestIndex);
+}
+
+__attribute__((target("avx512f")))
+inline void panelNearestAvx512(
+    const double* const* rows,
+    size_t dimension,
+    const double* panel,
+    size_t stride,
+    const double* norms,
+    size_t firstKernel,
+    double* nearestScores,
+    size_t* nearestIndices
+) {
+  const double* row0 = rows[0];
+  const double* row1 = rows[1];
+  const double* row2 = rows[2];
+  const double* row3 = rows[3];
+
+  __m512d sum00 = _mm512_setzero_pd(), sum01 = _mm512_setzero_pd();
+  __m512d sum10 = _mm512_setzero_pd(), sum11 = _mm512_setzero_pd();
+  __m512d sum20 = _mm512_setzero_pd(), sum21 = _mm512_setzero_pd();
+  __m512d sum30 = _mm512_setzero_pd(), sum31 = _mm512_setzero_pd();
+
+  for (size_t coordinate = 0; coordinate != dimension; ++coordinate, panel += stride) {
+    __m512d kernels0 = _mm512_load_pd(panel);
+    __m512d kernels1 = _mm512_load_pd(panel + 8);
+    __m512d value = _mm512_set1_pd(row0[coordinate]);
+    sum00 = _mm512_fmadd_pd(value, kernels0, sum00);
+    sum01 = _mm512_fmadd_pd(value, kernels1, sum01);
+    value = _mm512_set1_pd(row1[coordinate]);
+    sum10 = _mm512_fmadd_pd(value, kernels0, sum10);
+    sum11 = _mm512_fmadd_pd(value, kernels1, sum11);
+    value = _mm512_set1_pd(row2[coordinate]);
+    sum20 = _mm512_fmadd_pd(value, kernels0, sum20);
+    sum21 = _mm512_fmadd_pd(value, kernels1, sum21);
+    value = _mm512_set1_pd(row3[coordinate]);
+    sum30 = _mm512_fmadd_pd(value, kernels0, sum30);
+    sum31 = _mm512_fmadd_pd(value, kernels1, sum31);
+  }
+
+  __m512d norms0 = _mm512_loadu_pd(norms);
+  __m512d norms1 = _mm512_loadu_pd(norms + 8);
+  updateNearestAvx512(norms0, norms1, sum00, sum01, firstKernel, nearestScores[0],
+                      nearestIndices[0]);
+  updateNearestAvx512(norms0, norms1, sum10, sum11, firstKernel, nearestScores[1],
+                      nearestIndices[1]);
+  updateNearestAvx512(norms0, norms1, sum20, sum21, firstKernel, nearestScores[2],
+                      nearestIndices[2]);
+  updateNearestAvx512(norms0, norms1, sum30, sum31, firstKernel, nearestScores[3],
+                      nearestIndices[3]);
+}
+
+__attribute__((target("avx512f")))
+inline void updateNearestAvx512(
+    __m512 norms, __m512 sums, size_t firstKernel, float& nearestScore, size_t& nearestIndex
+) {
+  __m512 scores = _mm512_fmadd_ps(_mm512_set1_ps(-2.0f), sums, norms);
+  if (_mm512_cmp_ps_mask(scores, _mm512_set1_ps(nearestScore), _CMP_LT_OQ) == 0)
+    return;
+
+  float values[kernelsPerPanel];
+  _mm512_storeu_ps(values, scores);
+  updateNearest(values, firstKernel, nearestScore, nearestIndex);
+}
+
+__attribute__((target("avx512f")))
+inline void panelNearestAvx512(
+    const float* const* rows,
+    size_t dimension,
+    const float* panel,
+    size_t stride,
+    const float* norms,
+    size_t firstKernel,
+    float* nearestScores,
+    size_t* nearestIndices
+) {
+  const float* row0 = rows[0];
+  const float* row1 = rows[1];
+  const float* row2 = rows[2];
+  const float* row3 = rows[3];
+
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  __m512 sum2 = _mm512_setzero_ps();
+  __m512 sum3 = _mm512_setzero_ps();
+
+  for (size_t coordinate = 0; coordinate != dimension; ++coordinate, panel += stride) {
+    __m512 kernels = _mm512_load_ps(panel);
+    sum0 = _mm512_fmadd_ps(_mm512_set1_ps(row0[coordinate]), kernels, sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_set1_ps(row1[coordinate]), kernels, sum1);
+    sum2 = _mm512_fmadd_ps(_mm512_set1_ps(row2[coordinate]), kernels, sum2);
+    sum3 = _mm512_fmadd_ps(_mm512_set1_ps(row3[coordinate]), kernels, sum3);
+  }
+
+  __m512 kernelNorms = _mm512_loadu_ps(norms);
+  updateNearestAvx512(kernelNorms, sum0, firstKernel, nearestScores[0], nearestIndices[0]);
+  updateNearestAvx512(kernelNorms, sum1, firstKernel, nearestScores[1], nearestIndices[1]);
+  updateNearestAvx512(kernelNorms, sum2, firstKernel, nearestScores[2], nearestIndices[2]);
+  updateNearestAvx512(kernelNorms, sum3, firstKernel, nearestScores[3], nearestIndices[3]);
+}
+#endif
+
+// Picks the widest microkernel the running CPU supports
+template<typename Sample>
+inline PanelNearestFunction<Sample> selectPanelNearest() {
+#if defined(DICTAWAV_X86_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return panelNearestAvx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return panelNearestAvx2;
+#endif
+  return panelNearestScalar<Sample>;
+}
+
+// Writes on nearestIndices the nearest kernel to each of the framesCount frames, stored row
+// major. Kernels are coordinate major with stride values per coordinate, stride being a multiple
+// of kernelsPerPanel, and kernelNorms holds their squared norms, infinite for padding kernels.
+// Ties go to the lowest index
+template<typename Sample>
+inline void nearestKernelsBatched(
+    PanelNearestFunction<Sample> panelNearest,
+    const Sample* frames,
+    size_t framesCount,
+    size_t dimension,
+    const Sample* kernels,
+    const Sample* kernelNorms,
+    size_t stride,
+    size_t* nearestIndices
+) {
+  // A partial last row block writes its missing rows on the extra slots
+  Sample nearestScores[framesPerCacheBlock + frameRowsPerBlock];
+  size_t blockIndices[framesPerCacheBlock + frameRowsPerBlock];
+  const Sample* rows[frameRowsPerBlock];
+
+  for (size_t blockStart = 0; blockStart < framesCount; blockStart += framesPerCacheBlock) {
+    auto blockEnd = std::min(blockStart + framesPerCacheBlock, framesCount);
+    std::fill(std::begin(nearestScores), std::end(nearestScores),
+              std::numeric_limits<Sample>::max());
+    std::fill(std::begin(blockIndices), std::end(blockIndices), size_t(0));
+
+    for (size_t panel = 0; panel < stride; panel += kernelsPerPanel)
+      for (size_t row = blockStart; row < blockEnd; row += frameRowsPerBlock) {
+        // Missing rows repeat the last frame
+        for (size_t current = 0; current != frameRowsPerBlock; ++current)
+          rows[current] = frames + std::min(row + current, blockEnd - 1) * dimension;
+
+        panelNearest(
+            rows,
+            dimension,
+            kernels + panel,
+            stride,
+            kernelNorms + panel,
+            panel,
+            nearestScores + (row - blockStart),
+            blockIndices + (row - blockStart)
+        );
+      }
+
+    std::copy(blockIndices, blockIndices + (blockEnd - blockStart), nearestIndices + blockStart);
+  }
+}
+
+}
+
+#endif //DICTA_BATCHEDDISTANCES_H
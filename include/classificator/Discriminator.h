@@ -12,160 +12,110 @@
 #include <vector>
 #include <memory>
 #include "Ram.h"
+#include "AddressMapping.h"
 
 namespace DictaWav {
 class Discriminator {
  private:
-  size_t retinaSize;
-  size_t ramNumBits;
   size_t ramsCount;
   std::vector<Ram> rams;
-  std::shared_ptr<std::vector<size_t>> ramAddressMapping;
+  bool prefetchRams;
 
  public:
   Discriminator(
-      size_t retinaSize,
-      size_t ramNumBits,
-      std::shared_ptr<std::vector<size_t>> ramAddressMapping,
-      bool isCumulative = true
+      const AddressMapping& addressMapping,
+      bool isCumulative = true,
+      RamBackend ramBackend = RamBackend::HashMap
   ) :
-      retinaSize(retinaSize),
-      ramNumBits(ramNumBits),
-      ramAddressMapping(ramAddressMapping),
-      ramsCount(
-          static_cast<size_t>(std::ceil(
-              static_cast<double>(retinaSize) / static_cast<double>(ramNumBits)))
-      ) {
-    if (ramNumBits > 62)
-      throw std::runtime_error(
-          "WiSARD ERROR: Representation overflow due to number of bits being greater than 62."
-      );
-
+      ramsCount(addressMapping.getRamsCount()) {
+    // The last ram is smaller when retina's length isn't a multiple of bit's address number
     this->rams.reserve(this->ramsCount);
-    auto rest = retinaSize % ramNumBits;
+    for (size_t index = 0; index != this->ramsCount; ++index)
+      this->rams.emplace_back(Ram(addressMapping.getRamBitsCount(index), isCumulative, ramBackend));
 
-    if (rest == 0) {
-      for (size_t index = 0; index != this->ramsCount; ++index) {
-        this->rams.emplace_back(Ram(ramNumBits, isCumulative));
-      }
-    } else {
-      for (size_t index = 0; index != this->ramsCount - 1; ++index) {
-        this->rams.emplace_back(Ram(ramNumBits, isCumulative));
-      }
-      // The remaining rams
-      this->rams.emplace_back(Ram(rest, isCumulative));
-    }
+    this->prefetchRams = !this->rams.empty() && this->rams.front().canPrefetch();
   }
 
-  void train(const std::vector<char>& retina) {
-    size_t address;
-    size_t base;
-    size_t ramIndex = 0;
-
+  // Addresses come from the AddressMapping shared by all discriminators of a WiSARD, so they are
+  // computed once per retina, not once per discriminator
+  void train(const RamAddresses& addresses) {
     // Each group of ramNumBits is related with a ram
-    for (size_t index = 0;
-         index <= this->retinaSize - this->ramNumBits;
-         index += this->ramNumBits) {
-      address = 0;
-      base = 1;
-
-      for (size_t bitIndex = 0; bitIndex != this->ramNumBits; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[index + bitIndex]])
-          address += base;
-        base *= 2;
-      }
-
-      ramIndex = index / this->ramNumBits;
-      this->rams[ramIndex].insert(address);
-    }
-
-    // The rest of the retina when retina's length isn't a multiple of bit's address number
-    size_t restOfPositions = this->retinaSize % this->ramNumBits;
-    if (restOfPositions != 0) {
-      address = 0;
-      base = 1;
-      for (size_t bitIndex = 0; bitIndex != restOfPositions; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[this->retinaSize - restOfPositions - 1 + bitIndex]])
-          address += base;
-        base *= 2;
-      }
-      this->rams[ramIndex + 1].insert(address);
-    }
+    for (size_t ramIndex = 0; ramIndex != this->ramsCount; ++ramIndex)
+      this->rams[ramIndex].insert(addresses[ramIndex]);
+  }
+  void forget(const RamAddresses& addresses) {
+    for (size_t ramIndex = 0; ramIndex != this->ramsCount; ++ramIndex)
+      this->rams[ramIndex].remove(addresses[ramIndex]);
+  }
+  // Bytes used by all rams stored counts
+  size_t getMemoryUsage() const {
+    size_t memoryUsage = 0;
+    for (const auto& ram : this->rams)
+      memoryUsage += ram.getMemoryUsage();
+    return memoryUsage;
   }
-  void forget(const std::vector<char>& retina) {
-    size_t address;
-    size_t base;
-    size_t ramIndex = 0;
-
-    // Each group of ramNumBits is related with a ram
-    for (size_t index = 0;
-         index <= this->retinaSize - this->ramNumBits;
-         index += this->ramNumBits) {
-      address = 0;
-      base = 1;
-
-      for (size_t bitIndex = 0; bitIndex != this->ramNumBits; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[index + bitIndex]])
-          address += base;
-        base *= 2;
-      }
-
-      ramIndex = index / this->ramNumBits;
-      this->rams[ramIndex].remove(address);
-    }
 
-    // The rest of the retina when retina's length isn't a multiple of bit's address number
-    size_t restOfPositions = this->retinaSize % this->ramNumBits;
-    if (restOfPositions != 0) {
-      address = 0;
-      base = 1;
-      for (size_t bitIndex = 0; bitIndex != restOfPositions; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[this->retinaSize - restOfPositions - 1 + bitIndex]])
-          address += base;
-        base *= 2;
-      }
-      this->rams[ramIndex + 1].remove(address);
-    }
+  std::vector<unsigned> classify(const RamAddresses& addresses) const {
+    std::vector<unsigned> result(this->ramsCount);
+    this->classify(addresses.data(), result.data());
+    return result;
   }
-  std::vector<unsigned> classify(const std::vector<char>& retina) const {
-    size_t ramIndex = 0;
-    size_t address;
-    size_t base;
-    std::vector<unsigned> result;
-    result.reserve(this->ramsCount);
 
-    // Each group of ramNumBits is related with a ram
-    for (size_t index = 0;
-         index <= this->retinaSize - this->ramNumBits;
-         index += this->ramNumBits) {
-      address = 0;
-      base = 1;
+  // Writes the count of every ram on result, without allocating
+  void classify(const size_t* addresses, unsigned* result) const {
+    this->classify(addresses, result, 0, this->ramsCount);
+  }
 
-      for (size_t bitIndex = 0; bitIndex != this->ramNumBits; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[index + bitIndex]])
-          address += base;
-        base *= 2;
-      }
+  // Only the listed rams, their counts written one after the other
+  void classify(
+      const size_t* addresses,
+      const uint32_t* ramIndices,
+      size_t ramsCount,
+      unsigned* result
+  ) const {
+    for (size_t index = 0; index != ramsCount; ++index)
+      result[index] = this->rams[ramIndices[index]].get(addresses[ramIndices[index]]);
+  }
 
-      ramIndex = index / ramNumBits;
-      result.push_back(this->rams[ramIndex].get(address));
-    }
+  // Only rams from firstRam to lastRam
+  void classify(const size_t* addresses, unsigned* result, size_t firstRam, size_t lastRam) const {
+    for (size_t ramIndex = firstRam; ramIndex != lastRam; ++ramIndex)
+      result[ramIndex] = this->rams[ramIndex].get(addresses[ramIndex]);
+  }
 
-    // The rest of the retina, when retina's length isn't a multiple of bit's address number
-    size_t restOfPositions = this->retinaSize % this->ramNumBits;
-    if (restOfPositions != 0) {
-      address = 0;
-      base = 1;
+  // RAM counts of addressesCount retinas, each one written resultsStride counts after the
+  // previous one. Goes RAM after RAM, so each RAM table is swept once for all of them. On backends
+  // that can prefetch, each probe prefetches the one prefetchDistance retinas ahead
+  void classifyBatch(
+      const RamAddresses* addresses,
+      size_t addressesCount,
+      unsigned* results,
+      size_t resultsStride
+  ) const {
+    if (this->prefetchRams)
+      this->classifyBatch<true>(addresses, addressesCount, results, resultsStride);
+    else
+      this->classifyBatch<false>(addresses, addressesCount, results, resultsStride);
+  }
 
-      for (size_t bitIndex = 0; bitIndex != restOfPositions; ++bitIndex) {
-        if (retina[(*(this->ramAddressMapping))[this->retinaSize - restOfPositions - 1 + bitIndex]])
-          address += base;
-        base *= 2;
+ private:
+  static constexpr size_t prefetchDistance = 8;
+
+  template<bool prefetch>
+  void classifyBatch(
+      const RamAddresses* addresses,
+      size_t addressesCount,
+      unsigned* results,
+      size_t resultsStride
+  ) const {
+    for (size_t ramIndex = 0; ramIndex != this->ramsCount; ++ramIndex) {
+      const auto& ram = this->rams[ramIndex];
+      for (size_t index = 0; index != addressesCount; ++index) {
+        if (prefetch && index + prefetchDistance < addressesCount)
+          ram.prefetch(addresses[index + prefetchDistance][ramIndex]);
+        results[index * resultsStride + ramIndex] = ram.get(addresses[index][ramIndex]);
       }
-      result.push_back(this->rams[ramIndex + 1].get(address));
     }
-
-    return std::move(result);
   }
 };
 
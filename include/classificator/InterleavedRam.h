@@ -0,0 +1,296 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/04/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_INTERLEAVEDRAM_H
+#define DICTAWAV_INTERLEAVEDRAM_H
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+#include <variant>
+#include "RamStorage.h"
+
+namespace DictaWav {
+
+// Count of a class on an InterleavedRam address, classes are identified by dense ids
+struct ClassCount {
+  uint32_t classId;
+  unsigned count;
+};
+
+// Counts of the classes that wrote an InterleavedRam address, sorted by class id. Empty when no
+// class did
+class ClassCounts {
+ private:
+  const ClassCount* first = nullptr;
+  const ClassCount* last = nullptr;
+
+ public:
+  ClassCounts() = default;
+  ClassCounts(const ClassCount* first, const ClassCount* last) : first(first), last(last) {}
+
+  const ClassCount* begin() const { return this->first; }
+  const ClassCount* end() const { return this->last; }
+  bool empty() const { return this->first == this->last; }
+};
+
+// First count of a class id not lower than classId
+template<typename Iterator>
+Iterator findClassCount(Iterator first, Iterator last, uint32_t classId) {
+  return std::lower_bound(
+      first,
+      last,
+      classId,
+      [](const ClassCount& classCount, uint32_t id) { return classCount.classId < id; }
+  );
+}
+
+// Interleaved counterpart of HashMapRamStorage, a node and a counts vector per written address
+class HashMapInterleavedStorage {
+ private:
+  std::unordered_map<size_t, std::vector<ClassCount>> data;
+
+ public:
+  ClassCounts get(size_t address) const {
+    auto entry = this->data.find(address);
+    if (entry == this->data.end())
+      return ClassCounts();
+
+    return ClassCounts(entry->second.data(), entry->second.data() + entry->second.size());
+  }
+
+  void insert(size_t address, uint32_t classId, bool isCumulative) {
+    auto& counts = this->data[address];
+    auto classCount = findClassCount(counts.begin(), counts.end(), classId);
+
+    if (classCount == counts.end() || classCount->classId != classId)
+      counts.insert(classCount, ClassCount{classId, 1});
+    else if (!isCumulative)
+      classCount->count = 1;
+    else
+      classCount->count += 1;
+  }
+
+  void remove(size_t address, uint32_t classId, bool isCumulative) {
+    auto entry = this->data.find(address);
+    if (entry == this->data.end())
+      return;
+
+    auto& counts = entry->second;
+    auto classCount = findClassCount(counts.begin(), counts.end(), classId);
+    if (classCount == counts.end() || classCount->classId != classId)
+      return;
+
+    if (!isCumulative || --classCount->count == 0)
+      counts.erase(classCount);
+    if (counts.empty())
+      this->data.erase(entry);
+  }
+};
+
+// Class counts of every address of a RAM, each address's list a slice of a single pool so written
+// addresses don't allocate on their own. A full list moves to the end of the pool with twice its
+// capacity, its old slice left unused
+class ClassCountsPool {
+ public:
+  struct Slice {
+    uint32_t first = 0;
+    uint32_t size = 0;
+    uint32_t capacity = 0;
+  };
+
+ private:
+  std::vector<ClassCount> pool;
+
+ public:
+  ClassCounts get(const Slice& slice) const {
+    auto counts = this->pool.data() + slice.first;
+    return ClassCounts(counts, counts + slice.size);
+  }
+
+  void insert(Slice& slice, uint32_t classId, bool isCumulative) {
+    auto counts = this->pool.data() + slice.first;
+    auto classCount = findClassCount(counts, counts + slice.size, classId);
+
+    if (classCount != counts + slice.size && classCount->classId == classId) {
+      classCount->count = isCumulative ? classCount->count + 1 : 1;
+      return;
+    }
+
+    auto position = static_cast<size_t>(classCount - counts);
+    if (slice.size == slice.capacity)
+      this->grow(slice);
+
+    counts = this->pool.data() + slice.first;
+    std::copy_backward(counts + position, counts + slice.size, counts + slice.size + 1);
+    counts[position] = ClassCount{classId, 1};
+    ++slice.size;
+  }
+
+  // Counts reaching zero are dropped, reading the same as a never written address
+  void remove(Slice& slice, uint32_t classId, bool isCumulative) {
+    auto counts = this->pool.data() + slice.first;
+    auto classCount = findClassCount(counts, counts + slice.size, classId);
+    if (classCount == counts + slice.size || classCount->classId != classId)
+      return;
+
+    if (!isCumulative || --classCount->count == 0) {
+      std::copy(classCount + 1, counts + slice.size, classCount);
+      --slice.size;
+    }
+  }
+
+ private:
+  void grow(Slice& slice) {
+    auto capacity = slice.capacity == 0 ? 1 : slice.capacity * 2;
+    auto first = this->pool.size();
+    if (first + capacity > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error("WiSARD-RAM ERROR: Too many class counts on a single RAM");
+
+    this->pool.resize(first + capacity);
+    std::copy(
+        this->pool.begin() + slice.first,
+        this->pool.begin() + slice.first + slice.size,
+        this->pool.begin() + first
+    );
+    slice.first = static_cast<uint32_t>(first);
+    slice.capacity = capacity;
+  }
+};
+
+// Interleaved counterpart of OpenAddressingRamStorage, the table holding each address's slice
+class OpenAddressingInterleavedStorage {
+ private:
+  OpenAddressingTable<ClassCountsPool::Slice> table;
+  ClassCountsPool pool;
+
+ public:
+  ClassCounts get(size_t address) const {
+    auto slice = this->table.find(address);
+    return slice != nullptr ? this->pool.get(*slice) : ClassCounts();
+  }
+
+  void insert(size_t address, uint32_t classId, bool isCumulative) {
+    this->pool.insert(this->table.insert(address), classId, isCumulative);
+  }
+
+  void remove(size_t address, uint32_t classId, bool isCumulative) {
+    auto slice = this->table.find(address);
+    if (slice != nullptr)
+      this->pool.remove(*slice, classId, isCumulative);
+  }
+};
+
+// Interleaved counterpart of DenseRamStorage, a slice per possible address
+class DenseInterleavedStorage {
+ private:
+  std::vector<ClassCountsPool::Slice> slices;
+  ClassCountsPool pool;
+
+ public:
+  explicit DenseInterleavedStorage(size_t numBits) {
+    if (numBits > DenseRamStorage::maximumNumBits)
+      throw std::runtime_error(
+          "WiSARD-RAM ERROR: Dense RAMs take at most "
+              + std::to_string(DenseRamStorage::maximumNumBits) + " bits, got "
+              + std::to_string(numBits)
+      );
+
+    this->slices.resize(size_t(1) << numBits);
+  }
+
+  ClassCounts get(size_t address) const { return this->pool.get(this->slices[address]); }
+
+  void insert(size_t address, uint32_t classId, bool isCumulative) {
+    this->pool.insert(this->slices[address], classId, isCumulative);
+  }
+
+  void remove(size_t address, uint32_t classId, bool isCumulative) {
+    this->pool.remove(this->slices[address], classId, isCumulative);
+  }
+};
+
+// A RAM position shared by all classes, each address holding the counts of the classes that wrote
+// it, sorted by class id. A single lookup answers for every class, where per class RAMs take one
+// lookup each. Most addresses are written by a few classes only, so counts are a sparse list.
+// Counts are kept on the same RamBackend choices per class RAMs have
+class InterleavedRam {
+ private:
+  std::variant<HashMapInterleavedStorage, OpenAddressingInterleavedStorage, DenseInterleavedStorage>
+      data;
+  size_t maxAddress;
+  bool isCumulative;
+
+ public:
+  explicit InterleavedRam(
+      size_t numBits,
+      bool isCumulative = true,
+      RamBackend backend = RamBackend::HashMap
+  ) :
+      data(makeStorage(numBits, backend)),
+      maxAddress(static_cast<size_t>(std::pow(static_cast<size_t>(2), numBits))),
+      isCumulative(isCumulative) {}
+
+  void insert(size_t address, uint32_t classId) {
+    if (address > this->maxAddress)
+      throw std::runtime_error(
+          "WiSARD-RAM ERROR: Pushing address out of range 0 to "
+              + std::to_string(this->maxAddress)
+      );
+
+    std::visit(
+        [&](auto& storage) { storage.insert(address, classId, this->isCumulative); },
+        this->data
+    );
+  }
+
+  void remove(size_t address, uint32_t classId) {
+    if (address > this->maxAddress)
+      throw std::runtime_error(
+          "WiSARD-RAM ERROR: Removing address out of range 0 to " + std::to_string(this->maxAddress)
+      );
+
+    std::visit(
+        [&](auto& storage) { storage.remove(address, classId, this->isCumulative); },
+        this->data
+    );
+  }
+
+  // Counts of all classes on address
+  ClassCounts get(size_t address) const {
+    return std::visit([address](const auto& storage) { return storage.get(address); }, this->data);
+  }
+
+  unsigned get(size_t address, uint32_t classId) const {
+    auto counts = this->get(address);
+    auto classCount = findClassCount(counts.begin(), counts.end(), classId);
+    return classCount != counts.end() && classCount->classId == classId ? classCount->count : 0;
+  }
+
+ private:
+  static std::variant<
+      HashMapInterleavedStorage,
+      OpenAddressingInterleavedStorage,
+      DenseInterleavedStorage
+  > makeStorage(size_t numBits, RamBackend backend) {
+    if (backend == RamBackend::Dense)
+      return DenseInterleavedStorage(numBits);
+    if (backend == RamBackend::OpenAddressing)
+      return OpenAddressingInterleavedStorage();
+    return HashMapInterleavedStorage();
+  }
+};
+
+}
+
+#endif //DICTAWAV_INTERLEAVEDRAM_H
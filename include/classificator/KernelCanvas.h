@@ -12,39 +12,113 @@
 #include <random>
 #include <cmath>
 #include <limits>
-#include "Kernel.h"
+#include <memory>
+#include <stdexcept>
+#include "../preprocessor/SimdKernels.h"
+#include "KernelMatrix.h"
+#include "QuantizedKernelIndex.h"
+#include "Retina.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
 class KernelCanvas {
+ public:
+  // How each frame nearest kernel is found when painting the canvas
+  enum class SearchMode {
+    Single, // One frame at a time, with direct squared distances
+    Batched, // All frames at once, through a blocked matrix multiplication
+    PartialDistance, // One frame at a time, dropping kernels as soon as they can't be the nearest
+    Quantized // Approximate, 8 bits codes search with an exact rerank of the best candidates
+  };
+
  private:
   size_t numKernels;
   size_t kernelDimension;
   int outputFactor;
-  std::vector<Kernel> kernels{};
+  SearchMode searchMode;
+  KernelMatrix<Sample> kernels;
   std::vector<char> activeKernels{};
-  std::vector<std::vector<double>> processedFrames{};
+
+  // Canvas features, a row of kernelDimension * 4 values per frame: the frame and its running sum,
+  // z-scored and squashed by tanh, followed by the same values of the previous frame. Buffers are
+  // kept between audios, so processing doesn't allocate once they are big enough
+  std::vector<Sample> features{};
+  size_t framesCount = 0;
+  std::vector<Sample> means{};
+  std::vector<Sample> scales{};
+
+  // Batched search nearest kernels
+  std::vector<size_t> nearestKernels{};
+
+  // Quantized search index, and how often it disagreed with the exact search when tracked
+  std::unique_ptr<QuantizedKernelIndex<Sample>> quantizedIndex;
+  bool trackDisagreements = false;
+  size_t approximateSearchesCount = 0;
+  size_t disagreementsCount = 0;
 
  public:
-  KernelCanvas(size_t numKernels, size_t kernelDimension, int outputFactor = 1) :
+  KernelCanvas(
+      size_t numKernels,
+      size_t kernelDimension,
+      int outputFactor = 1,
+      SearchMode searchMode = SearchMode::Batched,
+      size_t rerankCount = QuantizedKernelIndex<Sample>::defaultRerankCount
+  ) :
       numKernels(numKernels),
       kernelDimension(kernelDimension),
-      activeKernels(numKernels, false),
-      outputFactor(outputFactor) {
-    this->kernels.reserve(numKernels);
-    for (size_t kernel = 0; kernel != numKernels; ++kernel)
-      this->kernels.emplace_back(Kernel(kernelDimension * 4));
+      outputFactor(outputFactor),
+      searchMode(searchMode),
+      kernels(numKernels, kernelDimension * 4),
+      activeKernels(numKernels, false) {
+    if (searchMode == SearchMode::Quantized)
+      this->quantizedIndex = std::make_unique<QuantizedKernelIndex<Sample>>(
+          this->kernels,
+          rerankCount
+      );
+  }
+
+  void process(const std::vector<std::vector<Sample>>& frames) {
+    this->beginFeatures(frames.size());
+    for (size_t index = 0; index != frames.size(); ++index)
+      this->addFrame(index, frames[index].data());
+    this->transformFeatures();
   }
 
-  void process(const std::vector<std::vector<double>>& frames) {
-    // Cleaning current canvas
-    this->processedFrames = std::vector<std::vector<double>>();
+  // Frames on a single matrix, like PreProcessor::extractProcessedFeatures, frameStride values
+  // apart, of which the first kernelDimension are used
+  void process(const Sample* frames, size_t framesCount, size_t frameStride) {
+    if (frameStride < this->kernelDimension)
+      throw std::runtime_error("KernelCanvas error: Frames are smaller than kernel dimension");
 
-    this->appendSumFrames(frames);
-    this->zScoreAndTanh();
-    this->replicateFeatures();
+    this->beginFeatures(framesCount);
+    for (size_t index = 0; index != framesCount; ++index)
+      this->addFrame(index, frames + index * frameStride);
+    this->transformFeatures();
   }
 
+  // Coordinates evaluated by partial distance searches so far, against the ones a full search
+  // would have evaluated
+  size_t getEvaluatedCoordinatesCount() const {
+    return this->kernels.getEvaluatedCoordinatesCount();
+  }
+
+  size_t getFullSearchCoordinatesCount() const {
+    return this->kernels.getFullSearchCoordinatesCount();
+  }
+
+  SearchMode getSearchMode() const { return this->searchMode; }
+
+  // Also runs the exact search on every quantized search, counting when their results differ.
+  // Both counts only cover searches made while tracking
+  void setDisagreementTracking(bool trackDisagreements) {
+    this->trackDisagreements = trackDisagreements;
+  }
+
+  size_t getApproximateSearchesCount() const { return this->approximateSearchesCount; }
+
+  size_t getDisagreementsCount() const { return this->disagreementsCount; }
+
   std::vector<char> getPaintedCanvas() {
     this->paintCanvas();
 
@@ -60,113 +134,178 @@ class KernelCanvas {
     return paintedCanvas;
   }
 
- private:
-  void appendSumFrames(const std::vector<std::vector<double>>& frames) {
-    // First frame
-    auto& firstFrame = frames[0];
-    std::vector<double> frame;
-    frame.reserve(this->kernelDimension * 2);
-    for (size_t doubling = 0; doubling != 2; ++doubling) {
-      for (size_t frameIndex = 0; frameIndex != this->kernelDimension; ++frameIndex) {
-        frame.push_back(firstFrame[frameIndex]);
-      }
-    }
+  // Painted canvas as a packed Retina of numKernels bits. Output replication is left to WiSARD,
+  // built with outputFactor retina replicas
+  Retina getPaintedRetina() {
+    this->paintCanvas();
 
-    this->processedFrames.emplace_back(frame);
-    frame = std::vector<double>();
-    frame.reserve(this->kernelDimension * 2);
+    Retina paintedRetina(this->numKernels);
+    for (size_t index = 0; index != this->activeKernels.size(); ++index)
+      if (this->activeKernels[index])
+        paintedRetina.set(index);
 
-    // Other frames
-    for (size_t index = 1; index != frames.size(); ++index) {
-      auto& currentFrame = frames[index];
+    this->cleanCanvas();
+    return paintedRetina;
+  }
 
-      for (size_t frameIndex = 0; frameIndex != this->kernelDimension; ++frameIndex)
-        frame.push_back(currentFrame[frameIndex]);
+ private:
+  void beginFeatures(size_t framesCount) {
+    if (framesCount == 0)
+      throw std::runtime_error("KernelCanvas error: There are no frames to process");
 
-      for (size_t frameIndex = 0; frameIndex != this->kernelDimension; ++frameIndex)
-        frame.push_back(
-            currentFrame[frameIndex]
-                + this->processedFrames[index - 1][frameIndex + this->kernelDimension]
-        );
+    auto doubledKernelDimension = this->kernelDimension * 2;
+    this->framesCount = framesCount;
+    this->features.resize(framesCount * this->kernels.getDimension());
+    this->means.assign(doubledKernelDimension, Sample(0));
+    this->scales.assign(doubledKernelDimension, Sample(0));
+  }
 
-      this->processedFrames.emplace_back(frame);
-      frame = std::vector<double>();
-      frame.reserve(this->kernelDimension * 2);
+  // Writes the frame and its running sum on the first half of its row, updating each column mean
+  // and squared deviations sum on the same pass (Welford's algorithm), kept on scales for now
+  void addFrame(size_t index, const Sample* frame) {
+    auto dimension = this->kernelDimension;
+    auto doubledKernelDimension = dimension * 2;
+    auto rowLength = this->kernels.getDimension();
+    Sample* row = this->features.data() + index * rowLength;
+
+    std::copy(frame, frame + dimension, row);
+    if (index == 0) {
+      // First frame running sum is the frame itself
+      std::copy(frame, frame + dimension, row + dimension);
+    } else {
+      const Sample* previousSum = row - rowLength + dimension;
+      for (size_t column = 0; column != dimension; ++column)
+        row[dimension + column] = frame[column] + previousSum[column];
+    }
+
+    auto count = static_cast<Sample>(index + 1);
+    for (size_t column = 0; column != doubledKernelDimension; ++column) {
+      const Sample deviation = row[column] - this->means[column];
+      this->means[column] += deviation / count;
+      this->scales[column] += deviation * (row[column] - this->means[column]);
     }
   }
 
-  void zScoreAndTanh() {
-    const auto processedFramesCount = this->processedFrames.size();
+  // Z-scores and squashes each row first half in place, copying it to the next row second half.
+  // Deviations are divided by the variance itself, as the canvas always did
+  void transformFeatures() {
     auto doubledKernelDimension = this->kernelDimension * 2;
-    auto processed = std::vector<std::vector<double>>();
-    processed.reserve(processedFramesCount);
+    auto rowLength = this->kernels.getDimension();
+    auto degreesOfFreedom = static_cast<Sample>(this->framesCount - 1);
 
-    std::vector<double> means(doubledKernelDimension);
-    std::vector<double> standardDeviations(doubledKernelDimension);
+    for (auto& scale : this->scales)
+      scale = degreesOfFreedom / scale;
 
-    for (const auto& frame : this->processedFrames)
-      for (size_t index = 0; index != doubledKernelDimension; ++index)
-        means[index] += frame[index];
+    // "Replicating features" on first frame just fill it with zeros
+    std::fill(this->features.begin() + doubledKernelDimension,
+              this->features.begin() + rowLength,
+              Sample(0));
 
-    for (auto& mean : means)
-      mean /= static_cast<double>(processedFramesCount); // Calculating mean for each dimension
+    for (size_t index = 0; index != this->framesCount; ++index) {
+      Sample* row = this->features.data() + index * rowLength;
+      scaledTanh(row, this->means.data(), this->scales.data(), row, doubledKernelDimension);
 
-    for (const auto& frame : this->processedFrames)
-      for (size_t index = 0; index != doubledKernelDimension; ++index) {
-        const double current = frame[index] - means[index];
-        standardDeviations[index] += current * current;
-      }
+      if (index + 1 != this->framesCount)
+        std::copy(row, row + doubledKernelDimension, row + rowLength + doubledKernelDimension);
+    }
+  }
 
-    for (auto& standardDeviation : standardDeviations)
-      // Calculating standard deviation for each dimension
-      standardDeviation /= static_cast<double>(processedFramesCount - 1);
+  const Sample* getFeatures(size_t index) const {
+    return this->features.data() + index * this->kernels.getDimension();
+  }
 
-    for (auto& frame: this->processedFrames) {
-      std::vector<double> zScoredFrame;
-      zScoredFrame.reserve(doubledKernelDimension);
+  size_t getNearestKernelIndex(const Sample* frame) {
+    // Frame is read in place, distances to all kernels are computed on a single pass
+    return this->kernels.getNearestKernelIndex(frame);
+  }
 
-      // Applying Z-Score and Tanh
-      for (size_t index = 0; index != doubledKernelDimension; ++index) {
-        zScoredFrame.push_back(
-            std::tanh((frame[index] - means[index]) / standardDeviations[index]));
-      }
+  void paintCanvas() {
+    if (this->searchMode == SearchMode::Batched) {
+      this->paintCanvasBatched();
+      return;
+    }
 
-      processed.push_back(zScoredFrame);
+    if (this->searchMode == SearchMode::PartialDistance) {
+      this->paintCanvasPartialDistance();
+      return;
     }
 
-    this->processedFrames = processed;
-  }
+    if (this->searchMode == SearchMode::Quantized) {
+      this->paintCanvasQuantized();
+      return;
+    }
 
-  void replicateFeatures() {
-    size_t doubledKernelDimension = this->kernelDimension * 2;
-    // "Replicating features" on first frame just fill it with zeros
-    for (size_t frameIndex = 0; frameIndex != doubledKernelDimension; ++frameIndex)
-      this->processedFrames[0].push_back(0.0);
+    for (size_t index = 0; index != this->framesCount; ++index)
+      this->activeKernels[this->getNearestKernelIndex(this->getFeatures(index))] = true;
+  }
 
-    for (size_t index = 1; index != this->processedFrames.size(); ++index)
-      for (size_t frameIndex = 0; frameIndex != doubledKernelDimension; ++frameIndex)
-        this->processedFrames[index].push_back(this->processedFrames[index - 1][frameIndex]);
+  void paintCanvasBatched() {
+    // Features rows are already the frames matrix the batched search expects
+    this->nearestKernels.resize(this->framesCount);
+    this->kernels.getNearestKernelIndices(
+        this->features.data(),
+        this->framesCount,
+        this->nearestKernels.data()
+    );
+
+    for (auto nearestKernel : this->nearestKernels)
+      this->activeKernels[nearestKernel] = true;
   }
 
-  size_t getNearestKernelIndex(const std::vector<double>& frame) {
-    auto currentKernel = Kernel(this->kernelDimension * 4, frame);
-    size_t nearestKernelIndex = 0;
-    double nearestKernelDistance = std::numeric_limits<double>::max();
+  void paintCanvasPartialDistance() {
+    auto dimension = this->kernels.getDimension();
+    auto framesCount = static_cast<Sample>(this->framesCount);
+
+    std::vector<Sample> means(dimension);
+    std::vector<Sample> variances(dimension);
+    for (size_t frame = 0; frame != this->framesCount; ++frame)
+      for (size_t index = 0; index != dimension; ++index)
+        means[index] += this->getFeatures(frame)[index];
+    for (auto& mean : means)
+      mean /= framesCount;
 
-    for (size_t index = 0; index != this->numKernels; ++index) {
-      auto distance = this->kernels[index].checkDistanceSquared(currentKernel);
-      if (distance < nearestKernelDistance) {
-        nearestKernelDistance = distance;
-        nearestKernelIndex = index;
+    for (size_t frame = 0; frame != this->framesCount; ++frame)
+      for (size_t index = 0; index != dimension; ++index) {
+        const Sample current = this->getFeatures(frame)[index] - means[index];
+        variances[index] += current * current;
       }
-    }
 
-    return nearestKernelIndex;
+    // Dimensions varying the most across this audio tell kernels apart sooner, and kernels near
+    // its mean frame are the likeliest to be the nearest ones
+    std::vector<size_t> dimensionOrder(dimension);
+    for (size_t index = 0; index != dimension; ++index)
+      dimensionOrder[index] = index;
+    std::stable_sort(dimensionOrder.begin(), dimensionOrder.end(),
+                     [&variances](size_t first, size_t second) {
+                       return variances[first] > variances[second];
+                     });
+
+    auto kernelOrder = this->kernels.getKernelsByDistance(means.data());
+    this->kernels.setSearchOrder(dimensionOrder, kernelOrder);
+
+    // Consecutive frames are alike, so the previous frame's nearest kernel is a tight first bound
+    size_t nearestKernel = kernelOrder[0];
+    for (size_t index = 0; index != this->framesCount; ++index) {
+      nearestKernel = this->kernels.getNearestKernelIndexPartial(
+          this->getFeatures(index),
+          nearestKernel
+      );
+      this->activeKernels[nearestKernel] = true;
+    }
   }
 
-  void paintCanvas() {
-    for (auto& frame : this->processedFrames) {
-      this->activeKernels[this->getNearestKernelIndex(frame)] = true;
+  void paintCanvasQuantized() {
+    for (size_t index = 0; index != this->framesCount; ++index) {
+      const Sample* frame = this->getFeatures(index);
+      auto nearestKernel = this->quantizedIndex->getNearestKernelIndex(frame, this->kernels);
+
+      if (this->trackDisagreements) {
+        ++this->approximateSearchesCount;
+        if (nearestKernel != this->getNearestKernelIndex(frame))
+          ++this->disagreementsCount;
+      }
+
+      this->activeKernels[nearestKernel] = true;
     }
   }
 
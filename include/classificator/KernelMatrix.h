@@ -0,0 +1,508 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTA_KERNELMATRIX_H
+#define DICTA_KERNELMATRIX_H
+
+#include <new>
+#include <cstdlib>
+#include <random>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "BatchedDistances.h"
+#include "X86Dispatch.h"
+
+namespace DictaWav {
+
+// Distance kernels take the kernel matrix coordinate major, stride values per coordinate, and
+// write the squared distance from query to each of the stride kernels. Kernels are processed 16
+// at a time with query coordinates broadcast, so stride must be a multiple of 16. SIMD paths fuse
+// multiplications and additions, so their distances may differ from scalar ones on the last bit
+template<typename Sample>
+using SquaredDistancesFunction =
+    void (*)(const Sample* coordinates, size_t stride, size_t dimension, const Sample* query,
+             Sample* distances);
+
+static constexpr size_t kernelsPerDistanceBlock = 16;
+
+template<typename Sample>
+inline void squaredDistancesScalar(
+    const Sample* coordinates,
+    size_t stride,
+    size_t dimension,
+    const Sample* query,
+    Sample* distances
+) {
+  for (size_t kernel = 0; kernel < stride; kernel += kernelsPerDistanceBlock) {
+    Sample sums[kernelsPerDistanceBlock] = {};
+    const Sample* column = coordinates + kernel;
+
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride)
+      for (size_t lane = 0; lane != kernelsPerDistanceBlock; ++lane) {
+        Sample current = column[lane] - query[coordinate];
+        sums[lane] += current * current;
+      }
+
+    std::copy(sums, sums + kernelsPerDistanceBlock, distances + kernel);
+  }
+}
+
+#if defined(DICTAWAV_X86_DISPATCH)
+__attribute__((target("avx2,fma")))
+inline void squaredDistancesAvx2(
+    const double* coordinates,
+    size_t stride,
+    size_t dimension,
+    const double* query,
+    double* distances
+) {
+  for (size_t kernel = 0; kernel < stride; kernel += kernelsPerDistanceBlock) {
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    __m256d sum2 = _mm256_setzero_pd();
+    __m256d sum3 = _mm256_setzero_pd();
+    const double* column = coordinates + kernel;
+
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride) {
+      __m256d value = _mm256_broadcast_sd(query + coordinate);
+      __m256d current0 = _mm256_sub_pd(_mm256_load_pd(column), value);
+      __m256d current1 = _mm256_sub_pd(_mm256_load_pd(column + 4), value);
+      __m256d current2 = _mm256_sub_pd(_mm256_load_pd(column + 8), value);
+      __m256d current3 = _mm256_sub_pd(_mm256_load_pd(column + 12), value);
+      sum0 = _mm256_fmadd_pd(current0, current0, sum0);
+      sum1 = _mm256_fmadd_pd(current1, current1, sum1);
+      sum2 = _mm256_fmadd_pd(current2, current2, sum2);
+      sum3 = _mm256_fmadd_pd(current3, current3, sum3);
+    }
+
+    _mm256_storeu_pd(distances + kernel, sum0);
+    _mm256_storeu_pd(distances + kernel + 4, sum1);
+    _mm256_storeu_pd(distances + kernel + 8, sum2);
+    _mm256_storeu_pd(distances + kernel + 12, sum3);
+  }
+}
+
+__attribute__((target("avx2,fma")))
+inline void squaredDistancesAvx2(
+    const float* coordinates,
+    size_t stride,
+    size_t dimension,
+    const float* query,
+    float* distances
+) {
+  for (size_t kernel = 0; kernel < stride; kernel += kernelsPerDistanceBlock) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    const float* column = coordinates + kernel;
+
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride) {
+      __m256 value = _mm256_broadcast_ss(query + coordinate);
+      __m256 current0 = _mm256_sub_ps(_mm256_load_ps(column), value);
+      __m256 current1 = _mm256_sub_ps(_mm256_load_ps(column + 8), value);
+      sum0 = _mm256_fmadd_ps(current0, current0, sum0);
+      sum1 = _mm256_fmadd_ps(current1, current1, sum1);
+    }
+
+    _mm256_storeu_ps(distances + kernel, sum0);
+    _mm256_storeu_ps(distances + kernel + 8, sum1);
+  }
+}
+
+__attribute__((target("avx512f")))
+inline void squaredDistancesAvx512(
+    const double* coordinates,
+    size_t stride,
+    size_t dimension,
+    const double* query,
+    double* distances
+) {
+  for (size_t kernel = 0; kernel < stride; kernel += kernelsPerDistanceBlock) {
+    __m512d sum0 = _mm512_setzero_pd();
+    __m512d sum1 = _mm512_setzero_pd();
+    const double* column = coordinates + kernel;
+
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride) {
+      __m512d value = _mm512_set1_pd(query[coordinate]);
+      __m512d current0 = _mm512_sub_pd(_mm512_load_pd(column), value);
+      __m512d current1 = _mm512_sub_pd(_mm512_load_pd(column + 8), value);
+      sum0 = _mm512_fmadd_pd(current0, current0, sum0);
+      sum1 = _mm512_fmadd_pd(current1, current1, sum1);
+    }
+
+    _mm512_storeu_pd(distances + kernel, sum0);
+    _mm512_storeu_pd(distances + kernel + 8, sum1);
+  }
+}
+
+__attribute__((target("avx512f")))
+inline void squaredDistancesAvx512(
+    const float* coordinates,
+    size_t stride,
+    size_t dimension,
+    const float* query,
+    float* distances
+) {
+  for (size_t kernel = 0; kernel < stride; kernel += kernelsPerDistanceBlock) {
+    __m512 sum = _mm512_setzero_ps();
+    const float* column = coordinates + kernel;
+
+    for (size_t coordinate = 0; coordinate != dimension; ++coordinate, column += stride) {
+      __m512 current = _mm512_sub_ps(_mm512_load_ps(column), _mm512_set1_ps(query[coordinate]));
+      sum = _mm512_fmadd_ps(current, current, sum);
+    }
+
+    _mm512_storeu_ps(distances + kernel, sum);
+  }
+}
+#endif
+
+// Picks the widest distance kernel the running CPU supports
+template<typename Sample>
+inline SquaredDistancesFunction<Sample> selectSquaredDistances() {
+#if defined(DICTAWAV_X86_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return squaredDistancesAvx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return squaredDistancesAvx2;
+#endif
+  return squaredDistancesScalar<Sample>;
+}
+
+// All KernelCanvas kernels on a single aligned matrix, stored coordinate major (structure of
+// arrays) so a SIMD register holds the same coordinate of consecutive kernels. Kernels count is
+// padded to a whole distance block, padding kernels are zeros and never reported as nearest
+template<typename Sample = double>
+class KernelMatrix {
+ private:
+  size_t kernelsCount;
+  size_t dimension;
+  size_t stride;
+  Sample* coordinates;
+  std::vector<Sample> distances;
+  SquaredDistancesFunction<Sample> squaredDistances;
+
+  // Squared norms of each kernel for batched searches, infinite on padding kernels
+  std::vector<Sample> kernelNorms;
+  PanelNearestFunction<Sample> panelNearest;
+
+  static_assert(kernelsPerPanel == kernelsPerDistanceBlock,
+                "Batched search panels must match the matrix padding");
+
+  // Partial distance search copy of the matrix, rows following dimensionOrder and columns
+  // following kernelOrder, with the query gathered on the same order
+  std::vector<size_t> dimensionOrder;
+  std::vector<size_t> kernelOrder;
+  std::vector<Sample> searchCoordinates;
+  std::vector<Sample> orderedQuery;
+
+  // Coordinates actually evaluated by partial distance searches, and how many a full search of
+  // the same queries would have evaluated
+  size_t evaluatedCoordinatesCount = 0;
+  size_t fullSearchCoordinatesCount = 0;
+
+  static constexpr size_t alignment = 64;
+  // Partial distances are checked against the nearest distance after every block of coordinates
+  static constexpr size_t coordinatesPerCheck = 8;
+  // Padding kernels on the search matrix, far enough to be dropped on the first check
+  static constexpr Sample paddingCoordinate = Sample(1e6);
+
+ public:
+  // Each coordinate is drawn uniformly from [-1, 1]
+  KernelMatrix(size_t kernelsCount, size_t dimension) :
+      kernelsCount(kernelsCount),
+      dimension(dimension),
+      stride(roundToBlock(kernelsCount)),
+      coordinates(allocate(stride * dimension)),
+      distances(stride),
+      squaredDistances(selectSquaredDistances<Sample>()),
+      kernelNorms(stride, std::numeric_limits<Sample>::infinity()),
+      panelNearest(selectPanelNearest<Sample>()),
+      orderedQuery(dimension) {
+    static std::random_device random;
+    static std::default_random_engine randomEngine(random());
+    static std::uniform_real_distribution<Sample>
+        distribution(Sample(-1.0), Sample(1.0) + std::numeric_limits<Sample>::min());
+
+    std::fill(this->coordinates, this->coordinates + this->stride * this->dimension, Sample(0));
+    // Drawn one kernel after the other, as if each one was generated on its own
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel)
+      for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate)
+        this->coordinates[coordinate * this->stride + kernel] = distribution(randomEngine);
+
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel) {
+      this->kernelNorms[kernel] = Sample(0);
+      for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate) {
+        auto value = this->coordinates[coordinate * this->stride + kernel];
+        this->kernelNorms[kernel] += value * value;
+      }
+    }
+
+    std::vector<size_t> identityDimensions(this->dimension);
+    std::vector<size_t> identityKernels(this->kernelsCount);
+    for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate)
+      identityDimensions[coordinate] = coordinate;
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel)
+      identityKernels[kernel] = kernel;
+    this->setSearchOrder(identityDimensions, identityKernels);
+  }
+
+  ~KernelMatrix() {
+    std::free(this->coordinates);
+  }
+
+  // Deleted copy constructor and operator
+  KernelMatrix(const KernelMatrix&) = delete;
+  KernelMatrix& operator=(const KernelMatrix&) = delete;
+
+  // Move constructor
+  KernelMatrix(KernelMatrix&& other) noexcept :
+      kernelsCount(other.kernelsCount),
+      dimension(other.dimension),
+      stride(other.stride),
+      coordinates(other.coordinates),
+      distances(std::move(other.distances)),
+      squaredDistances(other.squaredDistances),
+      kernelNorms(std::move(other.kernelNorms)),
+      panelNearest(other.panelNearest),
+      dimensionOrder(std::move(other.dimensionOrder)),
+      kernelOrder(std::move(other.kernelOrder)),
+      searchCoordinates(std::move(other.searchCoordinates)),
+      orderedQuery(std::move(other.orderedQuery)),
+      evaluatedCoordinatesCount(other.evaluatedCoordinatesCount),
+      fullSearchCoordinatesCount(other.fullSearchCoordinatesCount) {
+    other.kernelsCount = 0;
+    other.stride = 0;
+    other.coordinates = nullptr;
+  }
+
+  // Move operator
+  KernelMatrix& operator=(KernelMatrix&& other) noexcept {
+    if (this != &other) {
+      std::free(this->coordinates);
+
+      this->kernelsCount = other.kernelsCount;
+      this->dimension = other.dimension;
+      this->stride = other.stride;
+      this->coordinates = other.coordinates;
+      this->distances = std::move(other.distances);
+      this->squaredDistances = other.squaredDistances;
+      this->kernelNorms = std::move(other.kernelNorms);
+      this->panelNearest = other.panelNearest;
+      this->dimensionOrder = std::move(other.dimensionOrder);
+      this->kernelOrder = std::move(other.kernelOrder);
+      this->searchCoordinates = std::move(other.searchCoordinates);
+      this->orderedQuery = std::move(other.orderedQuery);
+      this->evaluatedCoordinatesCount = other.evaluatedCoordinatesCount;
+      this->fullSearchCoordinatesCount = other.fullSearchCoordinatesCount;
+
+      other.kernelsCount = 0;
+      other.stride = 0;
+      other.coordinates = nullptr;
+    }
+    return *this;
+  }
+
+  size_t getKernelsCount() const { return this->kernelsCount; }
+
+  size_t getDimension() const { return this->dimension; }
+
+  size_t getStride() const { return this->stride; }
+
+  Sample getCoordinate(size_t kernel, size_t coordinate) const {
+    return this->coordinates[coordinate * this->stride + kernel];
+  }
+
+  // Coordinate major matrix, getStride() values per coordinate
+  const Sample* getCoordinates() const { return this->coordinates; }
+
+  // Index of the kernel nearest to query, which must have getDimension() values. Ties go to the
+  // lowest index
+  size_t getNearestKernelIndex(const Sample* query) {
+    this->squaredDistances(
+        this->coordinates,
+        this->stride,
+        this->dimension,
+        query,
+        this->distances.data()
+    );
+
+    size_t nearestKernelIndex = 0;
+    Sample nearestKernelDistance = std::numeric_limits<Sample>::max();
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel)
+      if (this->distances[kernel] < nearestKernelDistance) {
+        nearestKernelDistance = this->distances[kernel];
+        nearestKernelIndex = kernel;
+      }
+
+    return nearestKernelIndex;
+  }
+
+  // Nearest kernel index of each of framesCount frames, stored one after the other on frames.
+  // Distances come from a blocked matrix multiplication, so on near ties the chosen kernel may
+  // differ from getNearestKernelIndex's by rounding
+  void getNearestKernelIndices(const Sample* frames, size_t framesCount, size_t* nearestIndices) {
+    nearestKernelsBatched(
+        this->panelNearest,
+        frames,
+        framesCount,
+        this->dimension,
+        this->coordinates,
+        this->kernelNorms.data(),
+        this->stride,
+        nearestIndices
+    );
+  }
+
+  // Kernel indices sorted by their distance to point, nearest first
+  std::vector<size_t> getKernelsByDistance(const Sample* point) {
+    this->squaredDistances(
+        this->coordinates,
+        this->stride,
+        this->dimension,
+        point,
+        this->distances.data()
+    );
+
+    std::vector<size_t> kernelsByDistance(this->kernelsCount);
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel)
+      kernelsByDistance[kernel] = kernel;
+    std::stable_sort(kernelsByDistance.begin(), kernelsByDistance.end(),
+                     [this](size_t first, size_t second) {
+                       return this->distances[first] < this->distances[second];
+                     });
+
+    return kernelsByDistance;
+  }
+
+  // Sets the order partial distance searches visit dimensions and kernels, both permutations.
+  // Searches prune sooner when discriminative dimensions and likely nearest kernels come first
+  void setSearchOrder(const std::vector<size_t>& dimensionOrder,
+                      const std::vector<size_t>& kernelOrder) {
+    if (dimensionOrder.size() != this->dimension || kernelOrder.size() != this->kernelsCount)
+      throw std::runtime_error("KernelMatrix error: Search order doesn't match the matrix");
+
+    this->dimensionOrder = dimensionOrder;
+    this->kernelOrder = kernelOrder;
+    this->searchCoordinates.assign(this->stride * this->dimension, paddingCoordinate);
+
+    for (size_t row = 0; row != this->dimension; ++row) {
+      const Sample* source = this->coordinates + dimensionOrder[row] * this->stride;
+      Sample* destination = this->searchCoordinates.data() + row * this->stride;
+      for (size_t column = 0; column != this->kernelsCount; ++column)
+        destination[column] = source[kernelOrder[column]];
+    }
+  }
+
+  // Same result as summing squared differences of every coordinate in order, with no fused
+  // operations, like squaredDistancesScalar does
+  Sample getSquaredDistance(size_t kernel, const Sample* query) const {
+    Sample distance = 0.0;
+    for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate) {
+      Sample current = this->coordinates[coordinate * this->stride + kernel] - query[coordinate];
+      distance += current * current;
+    }
+    return distance;
+  }
+
+  // Nearest kernel by partial distance search, starting from seedKernel, usually the previous
+  // frame's nearest, as the bound to beat. Kernels are visited 16 at a time on search order and
+  // dropped once all their partial distances exceed the bound. Partial sums are on a different
+  // order than full distances, so the bound allows for their rounding error, and every kernel
+  // surviving all coordinates is compared by getSquaredDistance. So the result is exactly the
+  // scalar full search's, ties going to the lowest index
+  size_t getNearestKernelIndexPartial(const Sample* query, size_t seedKernel) {
+    for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate)
+      this->orderedQuery[coordinate] = query[this->dimensionOrder[coordinate]];
+
+    // Sums of n non negative terms are off by at most n roundings
+    const Sample slack =
+        Sample(1) + Sample(2 * this->dimension + 2) * std::numeric_limits<Sample>::epsilon();
+
+    size_t nearestKernelIndex = seedKernel;
+    Sample nearestKernelDistance = this->getSquaredDistance(seedKernel, query);
+    Sample bound = nearestKernelDistance * slack;
+    size_t evaluatedCoordinates = this->dimension;
+
+    for (size_t block = 0; block < this->stride; block += kernelsPerDistanceBlock) {
+      Sample sums[kernelsPerDistanceBlock] = {};
+      bool anyCandidate = true;
+
+      for (size_t coordinate = 0; coordinate < this->dimension && anyCandidate;) {
+        auto checkEnd = std::min(coordinate + coordinatesPerCheck, this->dimension);
+        evaluatedCoordinates += (checkEnd - coordinate) * kernelsPerDistanceBlock;
+
+        for (; coordinate != checkEnd; ++coordinate) {
+          const Sample* row = this->searchCoordinates.data() + coordinate * this->stride + block;
+          Sample value = this->orderedQuery[coordinate];
+          for (size_t lane = 0; lane != kernelsPerDistanceBlock; ++lane) {
+            Sample current = row[lane] - value;
+            sums[lane] += current * current;
+          }
+        }
+
+        anyCandidate = false;
+        for (size_t lane = 0; lane != kernelsPerDistanceBlock; ++lane)
+          anyCandidate |= sums[lane] <= bound;
+      }
+
+      if (!anyCandidate)
+        continue;
+
+      auto lanes = std::min(kernelsPerDistanceBlock, this->kernelsCount - block);
+      for (size_t lane = 0; lane != lanes; ++lane) {
+        auto kernel = this->kernelOrder[block + lane];
+        if (sums[lane] > bound || kernel == nearestKernelIndex)
+          continue;
+
+        auto distance = this->getSquaredDistance(kernel, query);
+        evaluatedCoordinates += this->dimension;
+        if (distance < nearestKernelDistance
+            || (distance == nearestKernelDistance && kernel < nearestKernelIndex)) {
+          nearestKernelDistance = distance;
+          nearestKernelIndex = kernel;
+          bound = nearestKernelDistance * slack;
+        }
+      }
+    }
+
+    this->evaluatedCoordinatesCount += evaluatedCoordinates;
+    this->fullSearchCoordinatesCount += this->kernelsCount * this->dimension;
+    return nearestKernelIndex;
+  }
+
+  size_t getEvaluatedCoordinatesCount() const { return this->evaluatedCoordinatesCount; }
+
+  size_t getFullSearchCoordinatesCount() const { return this->fullSearchCoordinatesCount; }
+
+  void resetSearchCounters() {
+    this->evaluatedCoordinatesCount = 0;
+    this->fullSearchCoordinatesCount = 0;
+  }
+
+ private:
+  static size_t roundToBlock(size_t kernelsCount) {
+    return (kernelsCount + kernelsPerDistanceBlock - 1)
+        / kernelsPerDistanceBlock * kernelsPerDistanceBlock;
+  }
+
+  static Sample* allocate(size_t size) {
+    // aligned_alloc needs a size multiple of the alignment
+    auto bytes = (size * sizeof(Sample) + alignment - 1) / alignment * alignment;
+    auto memory = static_cast<Sample*>(std::aligned_alloc(alignment, std::max(bytes, alignment)));
+    if (memory == nullptr)
+      throw std::bad_alloc();
+    return memory;
+  }
+};
+
+}
+
+#endif //DICTA_KERNELMATRIX_H
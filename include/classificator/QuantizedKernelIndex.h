@@ -0,0 +1,235 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTA_QUANTIZEDKERNELINDEX_H
+#define DICTA_QUANTIZEDKERNELINDEX_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "KernelMatrix.h"
+
+namespace DictaWav {
+
+// Approximate distance kernels over 8 bits codes. Codes are grouped in blocks of 16 kernels,
+// each block holding, for every pair of coordinates, both codes of each kernel side by side.
+// Query pairs are packed as two 16 bits values on an int32, so SIMD paths widen codes to 16 bits
+// and square and add each pair with a single madd
+using QuantizedDistancesFunction =
+    void (*)(const int8_t* codes, size_t blocksCount, size_t pairsCount, const int32_t* queryPairs,
+             int32_t* scores);
+
+inline void quantizedDistancesScalar(
+    const int8_t* codes,
+    size_t blocksCount,
+    size_t pairsCount,
+    const int32_t* queryPairs,
+    int32_t* scores
+) {
+  for (size_t block = 0; block != blocksCount; ++block, scores += kernelsPerDistanceBlock) {
+    int32_t sums[kernelsPerDistanceBlock] = {};
+
+    for (size_t pair = 0; pair != pairsCount; ++pair, codes += 2 * kernelsPerDistanceBlock) {
+      auto first = static_cast<int16_t>(queryPairs[pair] & 0xFFFF);
+      auto second = static_cast<int16_t>(queryPairs[pair] >> 16);
+      for (size_t lane = 0; lane != kernelsPerDistanceBlock; ++lane) {
+        int32_t firstDifference = codes[2 * lane] - first;
+        int32_t secondDifference = codes[2 * lane + 1] - second;
+        sums[lane] += firstDifference * firstDifference + secondDifference * secondDifference;
+      }
+    }
+
+    std::copy(sums, sums + kernelsPerDistanceBlock, scores);
+  }
+}
+
+#if defined(DICTAWAV_X86_DISPATCH)
+__attribute__((target("avx2")))
+inline void quantizedDistancesAvx2(
+    const int8_t* codes,
+    size_t blocksCount,
+    size_t pairsCount,
+    const int32_t* queryPairs,
+    int32_t* scores
+) {
+  for (size_t block = 0; block != blocksCount; ++block, scores += kernelsPerDistanceBlock) {
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+
+    for (size_t pair = 0; pair != pairsCount; ++pair, codes += 2 * kernelsPerDistanceBlock) {
+      __m256i query = _mm256_set1_epi32(queryPairs[pair]);
+      __m256i difference0 = _mm256_sub_epi16(
+          _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes))), query);
+      __m256i difference1 = _mm256_sub_epi16(
+          _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + 16))),
+          query);
+      sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(difference0, difference0));
+      sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(difference1, difference1));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(scores), sum0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(scores + 8), sum1);
+  }
+}
+
+__attribute__((target("avx512bw")))
+inline void quantizedDistancesAvx512(
+    const int8_t* codes,
+    size_t blocksCount,
+    size_t pairsCount,
+    const int32_t* queryPairs,
+    int32_t* scores
+) {
+  for (size_t block = 0; block != blocksCount; ++block, scores += kernelsPerDistanceBlock) {
+    __m512i sum = _mm512_setzero_si512();
+
+    for (size_t pair = 0; pair != pairsCount; ++pair, codes += 2 * kernelsPerDistanceBlock) {
+      __m512i difference = _mm512_sub_epi16(
+          _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes))),
+          _mm512_set1_epi32(queryPairs[pair]));
+      sum = _mm512_add_epi32(sum, _mm512_madd_epi16(difference, difference));
+    }
+
+    _mm512_storeu_si512(scores, sum);
+  }
+}
+#endif
+
+// Picks the widest quantized distance kernel the running CPU supports
+inline QuantizedDistancesFunction selectQuantizedDistances() {
+#if defined(DICTAWAV_X86_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    return quantizedDistancesAvx512;
+  if (__builtin_cpu_supports("avx2"))
+    return quantizedDistancesAvx2;
+#endif
+  return quantizedDistancesScalar;
+}
+
+// Approximate nearest kernel index. Kernel coordinates, which lie on [-1, 1], are quantized once
+// to 8 bits codes, and each query goes through all codes, an eighth of the memory traffic of
+// the double matrix. The rerankCount kernels with lowest approximate distances are then compared
+// by their exact distances. rerankCount is the recall knob, with 1 the approximate nearest is
+// taken as is, and higher values make disagreements with the exact search rarer at the cost of
+// more exact distances
+template<typename Sample = double>
+class QuantizedKernelIndex {
+ private:
+  size_t kernelsCount;
+  size_t dimension;
+  size_t pairsCount;
+  size_t blocksCount;
+  size_t rerankCount;
+  std::vector<int8_t> codes;
+  std::vector<int32_t> queryPairs;
+  std::vector<int32_t> scores;
+  // Max heap of the best rerankCount (score, kernel) candidates found so far
+  std::vector<std::pair<int32_t, size_t>> candidates;
+  QuantizedDistancesFunction quantizedDistances;
+
+  static constexpr Sample quantizationScale = Sample(127);
+
+ public:
+  static constexpr size_t defaultRerankCount = 8;
+
+  explicit QuantizedKernelIndex(
+      const KernelMatrix<Sample>& kernels,
+      size_t rerankCount = defaultRerankCount
+  ) :
+      kernelsCount(kernels.getKernelsCount()),
+      dimension(kernels.getDimension()),
+      pairsCount((dimension + 1) / 2),
+      blocksCount(kernels.getStride() / kernelsPerDistanceBlock),
+      rerankCount(rerankCount),
+      codes(blocksCount * pairsCount * 2 * kernelsPerDistanceBlock),
+      queryPairs(pairsCount),
+      scores(kernels.getStride()),
+      quantizedDistances(selectQuantizedDistances()) {
+    if (rerankCount == 0)
+      throw std::runtime_error("QuantizedKernelIndex error: At least one kernel must be reranked");
+
+    // Padding kernels and the padding coordinate of odd dimensions are zeros on both sides,
+    // padding kernels are skipped when picking candidates
+    for (size_t kernel = 0; kernel != this->kernelsCount; ++kernel)
+      for (size_t coordinate = 0; coordinate != this->dimension; ++coordinate) {
+        auto block = kernel / kernelsPerDistanceBlock;
+        auto lane = kernel % kernelsPerDistanceBlock;
+        auto pair = coordinate / 2;
+        this->codes[(block * this->pairsCount + pair) * 2 * kernelsPerDistanceBlock
+            + 2 * lane + coordinate % 2] = quantize(kernels.getCoordinate(kernel, coordinate));
+      }
+  }
+
+  size_t getRerankCount() const { return this->rerankCount; }
+
+  size_t getNearestKernelIndex(const Sample* query, const KernelMatrix<Sample>& kernels) {
+    for (size_t pair = 0; pair != this->pairsCount; ++pair) {
+      auto first = static_cast<uint16_t>(quantize(query[2 * pair]));
+      auto second = 2 * pair + 1 < this->dimension
+                    ? static_cast<uint16_t>(quantize(query[2 * pair + 1]))
+                    : uint16_t(0);
+      this->queryPairs[pair] = static_cast<int32_t>(first | (uint32_t(second) << 16));
+    }
+
+    this->quantizedDistances(
+        this->codes.data(),
+        this->blocksCount,
+        this->pairsCount,
+        this->queryPairs.data(),
+        this->scores.data()
+    );
+
+    this->candidates.clear();
+    auto firstKernels = std::min(this->rerankCount, this->kernelsCount);
+    for (size_t kernel = 0; kernel != firstKernels; ++kernel)
+      this->candidates.emplace_back(this->scores[kernel], kernel);
+    std::make_heap(this->candidates.begin(), this->candidates.end());
+
+    // Most kernels are rejected by comparing against the worst candidate score alone
+    auto worstScore = this->candidates.front().first;
+    for (size_t kernel = firstKernels; kernel != this->kernelsCount; ++kernel) {
+      if (this->scores[kernel] >= worstScore)
+        continue;
+
+      std::pop_heap(this->candidates.begin(), this->candidates.end());
+      this->candidates.back() = std::make_pair(this->scores[kernel], kernel);
+      std::push_heap(this->candidates.begin(), this->candidates.end());
+      worstScore = this->candidates.front().first;
+    }
+
+    if (this->rerankCount == 1)
+      return this->candidates.front().second;
+
+    size_t nearestKernelIndex = 0;
+    Sample nearestKernelDistance = std::numeric_limits<Sample>::max();
+    for (const auto& candidate : this->candidates) {
+      auto distance = kernels.getSquaredDistance(candidate.second, query);
+      if (distance < nearestKernelDistance
+          || (distance == nearestKernelDistance && candidate.second < nearestKernelIndex)) {
+        nearestKernelDistance = distance;
+        nearestKernelIndex = candidate.second;
+      }
+    }
+
+    return nearestKernelIndex;
+  }
+
+ private:
+  static int8_t quantize(Sample value) {
+    value = std::max(Sample(-1), std::min(Sample(1), value));
+    return static_cast<int8_t>(std::lround(value * quantizationScale));
+  }
+};
+
+}
+
+#endif //DICTA_QUANTIZEDKERNELINDEX_H
@@ -9,22 +9,24 @@
 #ifndef DICTAWAV_RAM_H
 #define DICTAWAV_RAM_H
 
-#include <unordered_map>
 #include <exception>
+#include <variant>
 #include <cmath>
+#include "RamStorage.h"
 
 namespace DictaWav {
 
 class Ram {
  private:
-  std::unordered_map<size_t, unsigned> data;
+  std::variant<HashMapRamStorage, OpenAddressingRamStorage, DenseRamStorage> data;
   size_t maxAddress;
   bool isCumulative;
 
  public:
-  explicit Ram(size_t numBits, bool isCumulative = true) :
-      isCumulative(isCumulative),
-      maxAddress(static_cast<size_t>(std::pow(static_cast<size_t>(2), numBits))) {}
+  explicit Ram(size_t numBits, bool isCumulative = true, RamBackend backend = RamBackend::HashMap) :
+      data(makeStorage(numBits, backend)),
+      maxAddress(static_cast<size_t>(std::pow(static_cast<size_t>(2), numBits))),
+      isCumulative(isCumulative) {}
 
   void insert(size_t address) {
     if (address > this->maxAddress)
@@ -33,12 +35,7 @@ class Ram {
               + std::to_string(this->maxAddress)
       );
 
-    if (!this->isCumulative)
-      this->data[address] = 1;
-    else if (this->data.find(address) == this->data.end())
-      this->data[address] = 1;
-    else
-      this->data[address] += 1;
+    std::visit([&](auto& storage) { storage.insert(address, this->isCumulative); }, this->data);
   }
 
   void remove(size_t address) {
@@ -47,19 +44,38 @@ class Ram {
           "WiSARD-RAM ERROR: Removing address out of range 0 to " + std::to_string(this->maxAddress)
       );
 
-    if (!this->isCumulative)
-      this->data[address] = 0;
-    else if (this->data.find(address) == this->data.end())
-      this->data[address] = 0;
-    else if (this->data[address] > 0)
-      this->data[address] -= 1;
+    std::visit([&](auto& storage) { storage.remove(address, this->isCumulative); }, this->data);
   }
 
   unsigned get(size_t address) const {
-    if (this->data.find(address) == this->data.end())
-      return 0;
+    return std::visit([address](const auto& storage) { return storage.get(address); }, this->data);
+  }
+
+  // Whether prefetch does anything on this storage
+  bool canPrefetch() const {
+    return std::visit([](const auto& storage) { return storage.canPrefetch; }, this->data);
+  }
+
+  // Hints the storage to load what get(address) will read, issued a few probes before it
+  void prefetch(size_t address) const {
+    std::visit([address](const auto& storage) { storage.prefetch(address); }, this->data);
+  }
+
+  // Bytes used by the stored counts
+  size_t getMemoryUsage() const {
+    return std::visit([](const auto& storage) { return storage.getMemoryUsage(); }, this->data);
+  }
 
-    return this->data.at(address);
+ private:
+  static std::variant<HashMapRamStorage, OpenAddressingRamStorage, DenseRamStorage> makeStorage(
+      size_t numBits,
+      RamBackend backend
+  ) {
+    if (backend == RamBackend::Dense)
+      return DenseRamStorage(numBits);
+    if (backend == RamBackend::OpenAddressing)
+      return OpenAddressingRamStorage();
+    return HashMapRamStorage();
   }
 };
 
@@ -0,0 +1,231 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/04/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_RAMSTORAGE_H
+#define DICTAWAV_RAMSTORAGE_H
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <string>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace DictaWav {
+
+// Where a Ram, or an InterleavedRam, keeps its address counts. Every storage reads never written
+// addresses as 0, on cumulative RAMs insert and remove add and subtract one, otherwise they set the
+// count to 1 and 0
+enum class RamBackend {
+  HashMap, // std::unordered_map, a node per written address
+  OpenAddressing, // Flat table with inline keys and linear probing, for wide addresses
+  Dense // A counter per possible address, for RAMs of up to 16 bits
+};
+
+class HashMapRamStorage {
+ private:
+  std::unordered_map<size_t, unsigned> data;
+
+ public:
+  unsigned get(size_t address) const {
+    auto entry = this->data.find(address);
+    return entry != this->data.end() ? entry->second : 0;
+  }
+
+  // Nodes are only reached through the bucket, so there's nothing to fetch ahead of get
+  static constexpr bool canPrefetch = false;
+  void prefetch(size_t) const {}
+
+  void insert(size_t address, bool isCumulative) {
+    // A missing address is value initialized to 0 by operator[], so it's a single lookup
+    auto& count = this->data[address];
+    count = isCumulative ? count + 1 : 1;
+  }
+
+  void remove(size_t address, bool isCumulative) {
+    auto entry = this->data.find(address);
+    if (entry == this->data.end())
+      return;
+
+    if (!isCumulative)
+      entry->second = 0;
+    else if (entry->second > 0)
+      entry->second -= 1;
+  }
+
+  // Approximated, nodes are taken as a pointer and the stored pair
+  size_t getMemoryUsage() const {
+    return this->data.bucket_count() * sizeof(void*)
+        + this->data.size() * (sizeof(void*) + sizeof(std::pair<const size_t, unsigned>));
+  }
+};
+
+// Power of 2 sized table of addresses and their values, probed linearly from a Fibonacci hash of
+// the address. Addresses and values are kept apart, so probes walk 8 addresses per cache line and
+// only the hit reads a value. The table is kept at most 3/4 full.
+// Addresses are never erased, storages read a value back to its initial state as missing
+template<typename Value>
+class OpenAddressingTable {
+ private:
+  // Ram addresses have at most 62 bits, so this one is never used
+  static constexpr uint64_t emptyAddress = std::numeric_limits<uint64_t>::max();
+  static constexpr size_t initialCapacity = 16;
+
+  std::vector<uint64_t> addresses;
+  std::vector<Value> values;
+  size_t usedSlots = 0;
+  unsigned shift = 0;
+
+  size_t getSlotIndex(size_t address) const {
+    return static_cast<size_t>((uint64_t(address) * 0x9E3779B97F4A7C15ull) >> this->shift);
+  }
+
+  // Slot holding address, or the empty slot where it would be inserted
+  size_t findSlot(size_t address) const {
+    auto mask = this->addresses.size() - 1;
+    auto index = this->getSlotIndex(address);
+    while (this->addresses[index] != address && this->addresses[index] != emptyAddress)
+      index = (index + 1) & mask;
+
+    return index;
+  }
+
+  void grow() {
+    auto previousAddresses = std::move(this->addresses);
+    auto previousValues = std::move(this->values);
+    auto capacity = previousAddresses.empty() ? initialCapacity : previousAddresses.size() * 2;
+
+    this->addresses.assign(capacity, emptyAddress);
+    this->values.assign(capacity, Value());
+    this->shift = 64;
+    for (auto size = capacity; size > 1; size >>= 1)
+      --this->shift;
+
+    for (size_t slot = 0; slot != previousAddresses.size(); ++slot)
+      if (previousAddresses[slot] != emptyAddress) {
+        auto index = this->findSlot(previousAddresses[slot]);
+        this->addresses[index] = previousAddresses[slot];
+        this->values[index] = std::move(previousValues[slot]);
+      }
+  }
+
+ public:
+  // Value of address, nullptr when it was never inserted
+  const Value* find(size_t address) const {
+    if (this->addresses.empty())
+      return nullptr;
+
+    auto index = this->findSlot(address);
+    return this->addresses[index] == address ? &this->values[index] : nullptr;
+  }
+  Value* find(size_t address) {
+    return const_cast<Value*>(static_cast<const OpenAddressingTable&>(*this).find(address));
+  }
+
+  // Value of address, a value initialized one when it's new
+  Value& insert(size_t address) {
+    if (4 * (this->usedSlots + 1) > 3 * this->addresses.size())
+      this->grow();
+
+    auto index = this->findSlot(address);
+    if (this->addresses[index] == emptyAddress) {
+      this->addresses[index] = address;
+      ++this->usedSlots;
+    }
+    return this->values[index];
+  }
+
+  // Brings the first probed slot into cache ahead of find
+  void prefetch(size_t address) const {
+    if (!this->addresses.empty())
+      __builtin_prefetch(this->addresses.data() + this->getSlotIndex(address));
+  }
+
+  size_t getMemoryUsage() const {
+    return this->addresses.capacity() * sizeof(uint64_t) + this->values.capacity() * sizeof(Value);
+  }
+};
+
+class OpenAddressingRamStorage {
+ private:
+  OpenAddressingTable<unsigned> table;
+
+ public:
+  unsigned get(size_t address) const {
+    auto count = this->table.find(address);
+    return count != nullptr ? *count : 0;
+  }
+
+  static constexpr bool canPrefetch = true;
+  void prefetch(size_t address) const { this->table.prefetch(address); }
+
+  void insert(size_t address, bool isCumulative) {
+    auto& count = this->table.insert(address);
+    count = isCumulative ? count + 1 : 1;
+  }
+
+  void remove(size_t address, bool isCumulative) {
+    auto count = this->table.find(address);
+    if (count == nullptr)
+      return;
+
+    if (!isCumulative)
+      *count = 0;
+    else if (*count > 0)
+      *count -= 1;
+  }
+
+  size_t getMemoryUsage() const { return this->table.getMemoryUsage(); }
+};
+
+// 16 bits counters for every one of the 2^numBits addresses, saturating instead of wrapping
+class DenseRamStorage {
+ private:
+  std::vector<uint16_t> counts;
+
+ public:
+  static constexpr size_t maximumNumBits = 16;
+
+  explicit DenseRamStorage(size_t numBits) {
+    if (numBits > maximumNumBits)
+      throw std::runtime_error(
+          "WiSARD-RAM ERROR: Dense RAMs take at most " + std::to_string(maximumNumBits)
+              + " bits, got " + std::to_string(numBits)
+      );
+
+    this->counts.resize(size_t(1) << numBits);
+  }
+
+  unsigned get(size_t address) const { return this->counts[address]; }
+
+  static constexpr bool canPrefetch = true;
+  void prefetch(size_t address) const { __builtin_prefetch(this->counts.data() + address); }
+
+  void insert(size_t address, bool isCumulative) {
+    auto& count = this->counts[address];
+    if (!isCumulative)
+      count = 1;
+    else if (count != std::numeric_limits<uint16_t>::max())
+      ++count;
+  }
+
+  void remove(size_t address, bool isCumulative) {
+    auto& count = this->counts[address];
+    if (!isCumulative)
+      count = 0;
+    else if (count > 0)
+      --count;
+  }
+
+  size_t getMemoryUsage() const { return this->counts.capacity() * sizeof(uint16_t); }
+};
+
+}
+
+#endif //DICTAWAV_RAMSTORAGE_H
@@ -0,0 +1,73 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/04/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_RETINA_H
+#define DICTAWAV_RETINA_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace DictaWav {
+
+// Packed binary input of a WiSARD, 64 bits per word. A 2048 bits canvas fits on 256 bytes, where
+// the old one byte per bit retina, replicated for every canvas output, took 20KB. Replication is
+// left to the address mapping, which reads the same bit once for each replica.
+// Painted canvases are sparse, so set bits are also listed, in the order they were set, and
+// addresses can be built from them alone. Bit bitsCount, on an extra word, is never set, address
+// mappings pad short RAMs with it
+class Retina {
+ private:
+  size_t bitsCount;
+  std::vector<uint64_t> words;
+  std::vector<uint32_t> activeBits;
+
+  static constexpr size_t bitsPerWord = 64;
+
+ public:
+  explicit Retina(size_t bitsCount) :
+      bitsCount(bitsCount),
+      words(bitsCount / bitsPerWord + 1) {}
+
+  // Packs a one byte per bit retina, any non zero byte is a set bit
+  explicit Retina(const std::vector<char>& bits) : Retina(bits.size()) {
+    for (size_t bit = 0; bit != bits.size(); ++bit)
+      if (bits[bit])
+        this->set(bit);
+  }
+
+  void set(size_t bit) {
+    auto& word = this->words[bit / bitsPerWord];
+    auto mask = uint64_t(1) << (bit % bitsPerWord);
+    if (word & mask)
+      return;
+
+    word |= mask;
+    this->activeBits.push_back(static_cast<uint32_t>(bit));
+  }
+
+  bool test(size_t bit) const {
+    return (this->words[bit / bitsPerWord] >> (bit % bitsPerWord)) & 1;
+  }
+
+  void clear() {
+    for (auto bit : this->activeBits)
+      this->words[bit / bitsPerWord] = 0;
+    this->activeBits.clear();
+  }
+
+  size_t getBitsCount() const { return this->bitsCount; }
+
+  const std::vector<uint64_t>& getWords() const { return this->words; }
+
+  const std::vector<uint32_t>& getActiveBits() const { return this->activeBits; }
+};
+
+}
+
+#endif //DICTAWAV_RETINA_H
@@ -16,21 +16,77 @@
 #include <random>
 #include <cmath>
 #include <memory>
+#include <stdexcept>
 
+#include "Retina.h"
+#include "AddressMapping.h"
 #include "Discriminator.h"
+#include "InterleavedRam.h"
 
 namespace DictaWav {
 
 class Wisard {
+ public:
+  // How RAM contents are stored
+  enum class Storage {
+    PerClass, // A discriminator per class, each one with its own RAMs
+    ClassInterleaved // A RAM per position shared by all classes, probed once for all of them
+  };
 
-  size_t retinaSize;
-  size_t ramNumBits;
+ private:
   bool useBleaching;
   double minimumConfidence;
   unsigned bleachingThreshold;
   bool isCumulative;
-  std::unordered_map<std::string, Discriminator> discriminators;
-  std::shared_ptr<std::vector<size_t>> ramAddressMapping;
+  Storage storage;
+  RamBackend ramBackend; // Of the discriminator RAMs or of the interleaved ones, as storage takes
+  bool useProgressiveScoring;
+  std::shared_ptr<const AddressMapping> addressMapping;
+
+  // Classes get dense ids on their first training, scoring works on ids and names are only
+  // resolved on the way out
+  std::unordered_map<std::string, uint32_t> classIds;
+  std::vector<std::string> classNames;
+
+  // PerClass storage, the discriminator of each class id
+  std::vector<Discriminator> discriminators;
+
+  // ClassInterleaved storage
+  std::vector<InterleavedRam> interleavedRams;
+
+  // Progressive scoring statistics, RAM probes left out and RAM probes a full scoring takes. Only
+  // counted while tracked, as they're shared by every classifying thread
+  bool trackProgressiveScoring = false;
+  size_t skippedRamsCount = 0;
+  size_t classifiedRamsCount = 0;
+
+  // Candidate pruning, see setCandidatePruning. Every class is scored in full while shortlistSize
+  // is 0
+  size_t shortlistSize = 0;
+  std::vector<uint32_t> coarseRams;
+
+  // Buffers reused by every classification of a thread, so steady state scoring doesn't allocate
+  struct ScoringScratch {
+    RamAddresses addresses;
+    std::vector<unsigned> ramResults; // ramsCount counts per class, class after class
+    std::vector<unsigned> coarseResults; // Candidate pruning's coarse RAM counts, alike
+    std::vector<double> scores;
+    std::vector<double> bleachedScores;
+    std::vector<unsigned> votes;
+    std::vector<ClassCount> bleachingCounts;
+    std::vector<unsigned> histogram;
+    std::vector<uint32_t> shortlist;
+    std::vector<uint32_t> shortlistIndices; // Of every class id, noShortlistIndex when left out
+  };
+
+  struct Decision {
+    double confidence;
+    size_t classId;
+    double probability;
+  };
+
+  static constexpr size_t noClass = static_cast<size_t>(-1);
+  static constexpr uint32_t noShortlistIndex = static_cast<uint32_t>(-1);
 
  public:
   Wisard(
@@ -40,157 +96,758 @@ class Wisard {
       double minimumConfidence = 0.002,
       unsigned bleachingThreshold = 1,
       bool randomizePositions = true,
-      bool isCumulative = true
+      bool isCumulative = true,
+      size_t retinaReplicas = 1,
+      Storage storage = Storage::PerClass,
+      RamBackend ramBackend = RamBackend::HashMap,
+      bool useProgressiveScoring = false
   ) :
-      retinaSize(retinaSize),
-      ramNumBits(ramNumBits),
       useBleaching(useBleaching),
       minimumConfidence(minimumConfidence),
       bleachingThreshold(bleachingThreshold),
       isCumulative(isCumulative),
-      ramAddressMapping(std::make_shared<std::vector<size_t>>(retinaSize)) {
-
-    for (size_t index = 0; index != retinaSize; ++index)
-      (*(this->ramAddressMapping))[index] = index;
-
-    if (randomizePositions)
-      std::shuffle(
-          this->ramAddressMapping->begin(),
-          this->ramAddressMapping->end(),
-          //          std::default_random_engine(std::chrono::system_clock::now().time_since_epoch().count())
-          std::mt19937(std::random_device()())
+      storage(storage),
+      ramBackend(ramBackend),
+      useProgressiveScoring(useProgressiveScoring),
+      addressMapping(std::make_shared<const AddressMapping>(
+          retinaSize,
+          ramNumBits,
+          randomizePositions,
+          retinaReplicas
+      )) {
+    if (storage != Storage::ClassInterleaved)
+      return;
+
+    auto ramsCount = this->addressMapping->getRamsCount();
+    this->interleavedRams.reserve(ramsCount);
+    for (size_t index = 0; index != ramsCount; ++index)
+      this->interleavedRams.emplace_back(
+          this->addressMapping->getRamBitsCount(index),
+          isCumulative,
+          ramBackend
       );
   }
 
+  // Retinas have retinaSize / retinaReplicas bits, each one read by retinaReplicas positions.
+  // Overloads taking a std::vector<char>, one byte per bit, pack it into a Retina first
+  void train(const Retina& retina, const std::string& className) {
+    this->train(this->getRamAddresses(retina), className);
+  }
   void train(const std::vector<char>& retina, const std::string& className) {
+    this->train(Retina(retina), className);
+  }
+
+  // Addresses of a retina on every RAM, the same for all discriminators. Computing them once lets
+  // the same retina be trained, forgotten or classified on many classes
+  RamAddresses getRamAddresses(const Retina& retina) const {
+    this->addressMapping->checkRetina(retina);
+    return this->addressMapping->computeAddresses(retina);
+  }
+
+  void train(const RamAddresses& addresses, const std::string& className) {
+    this->addressMapping->checkAddresses(addresses);
+
     // Checking if class name exists before creating a new discriminator
-    if (this->discriminators.find(className) == this->discriminators.end())
-      this->discriminators.insert({
-                                      className, Discriminator(
-              this->retinaSize,
-              this->ramNumBits,
-              this->ramAddressMapping,
-              this->isCumulative
-          )
-                                  });
+    auto[classEntry, isNewClass] = this->classIds.emplace(className, this->classNames.size());
+    if (isNewClass) {
+      this->classNames.push_back(className);
+      if (this->storage == Storage::PerClass)
+        this->discriminators.emplace_back(
+            *(this->addressMapping),
+            this->isCumulative,
+            this->ramBackend
+        );
+    }
+
+    if (this->storage == Storage::ClassInterleaved) {
+      for (size_t ramIndex = 0; ramIndex != this->interleavedRams.size(); ++ramIndex)
+        this->interleavedRams[ramIndex].insert(addresses[ramIndex], classEntry->second);
+      return;
+    }
 
     // Training discriminator
-    this->discriminators.at(className).train(retina);
+    this->discriminators[classEntry->second].train(addresses);
+  }
+
+  void forget(const Retina& retina, const std::string& className) {
+    this->forget(this->getRamAddresses(retina), className);
   }
   void forget(const std::vector<char>& retina, const std::string& className) {
-    if (this->discriminators.find(className) != this->discriminators.end())
-      this->discriminators.at(className).forget(retina);
+    this->forget(Retina(retina), className);
   }
+  void forget(const RamAddresses& addresses, const std::string& className) {
+    this->addressMapping->checkAddresses(addresses);
+
+    auto classId = this->classIds.find(className);
+    if (classId == this->classIds.end())
+      return;
+
+    if (this->storage == Storage::ClassInterleaved) {
+      for (size_t ramIndex = 0; ramIndex != this->interleavedRams.size(); ++ramIndex)
+        this->interleavedRams[ramIndex].remove(addresses[ramIndex], classId->second);
+      return;
+    }
+
+    this->discriminators[classId->second].forget(addresses);
+  }
+
+  std::string classify(const Retina& retina) {
+    if (this->useProgressiveScoring)
+      return this->classifyProgressively(retina);
 
-  std::string classify(const std::vector<char>& retina) {
     return this->classificationConfidenceAndProbability(retina).second.first;
   }
+  std::string classify(const std::vector<char>& retina) {
+    return this->classify(Retina(retina));
+  }
+
+  std::unordered_map<std::string, double> classificationsProbabilities(const Retina& retina) {
+    return this->classificationsProbabilities(this->getRamAddresses(retina));
+  }
 
   std::unordered_map<std::string, double> classificationsProbabilities(
-      const std::vector<char>& retina
+      const RamAddresses& addresses
   ) {
-    std::unordered_map<std::string, double> result(this->discriminators.size());
-    std::unordered_map<std::string, std::vector<unsigned>> ramResults(this->discriminators.size());
+    this->addressMapping->checkAddresses(addresses);
 
-    auto ramsCount = std::ceil(
-        static_cast<double>(this->retinaSize) / static_cast<double>(this->ramNumBits)
-    );
+    auto& scratch = getScratch();
+    scratch.ramResults.resize(this->classNames.size() * this->addressMapping->getRamsCount());
+    this->probeRams(addresses.data(), scratch.ramResults.data(), 0, addresses.size());
 
-    // Testing with all discriminators
-    for (const auto&[className, discriminator] : this->discriminators) {
-      auto ramResult = discriminator.classify(retina);
+    auto classesCount = this->classNames.size();
+    return this->namedProbabilities(
+        this->scoreClasses(scratch.ramResults.data(), classesCount, scratch)
+    );
+  }
 
-      int positiveVotes = 0;
-      for (size_t ramResultsIndex = 0; ramResultsIndex != ramResult.size(); ++ramResultsIndex)
-        if (ramResult[ramResultsIndex] > 0)
-          ++positiveVotes;
+  std::unordered_map<std::string, double> classificationsProbabilities(
+      const std::vector<char>& retina
+  ) {
+    return this->classificationsProbabilities(Retina(retina));
+  }
 
-      // Calculating probability to see what percentage of rams recognize the element
-      result[className] = static_cast<double>(positiveVotes) / ramsCount;
-      ramResults[className] = ramResult;
+  // Classifies many retinas at once. On the PerClass storage RAMs are probed RAM after RAM instead
+  // of retina after retina, each RAM table swept once per block of retinas and, on the
+  // OpenAddressing and Dense backends, its probes prefetched ahead. The ClassInterleaved storage
+  // probes one retina at a time, as classify does. Results are the ones classify gives
+  std::vector<std::string> classifyBatch(const std::vector<Retina>& retinas) {
+    std::vector<std::string> classifications;
+    classifications.reserve(retinas.size());
+
+    // Addresses are computed as each retina is probed, so they're still cached when read
+    if (this->storage == Storage::ClassInterleaved) {
+      auto& scratch = getScratch();
+      scratch.addresses.resize(this->addressMapping->getRamsCount());
+      for (const auto& retina : retinas) {
+        this->addressMapping->checkRetina(retina);
+        this->addressMapping->computeAddresses(retina, scratch.addresses.data());
+        classifications.push_back(
+            this->classifyOnAllClasses(scratch.addresses.data(), scratch).second.first
+        );
+      }
+      return classifications;
     }
 
-    if (this->useBleaching)
-      result = this->applyBleaching(result, ramResults, ramsCount);
+    std::vector<RamAddresses> addresses;
+    addresses.reserve(retinas.size());
+    for (const auto& retina : retinas)
+      addresses.push_back(this->getRamAddresses(retina));
+
+    this->scoreBatch(addresses, [&](const double* scores) {
+      classifications.push_back(this->decide(scores, this->classNames.size()).second.first);
+    });
+
+    return classifications;
+  }
+
+  std::vector<std::unordered_map<std::string, double>> classificationsProbabilitiesBatch(
+      const std::vector<RamAddresses>& addresses
+  ) {
+    std::vector<std::unordered_map<std::string, double>> results;
+    results.reserve(addresses.size());
+    this->scoreBatch(addresses, [&](const double* scores) {
+      results.push_back(this->namedProbabilities(scores));
+    });
 
-    return std::move(result);
+    return results;
   }
 
+  std::pair<std::string, double> classificationAndProbability(const Retina& retina) {
+    return this->classificationConfidenceAndProbability(retina).second;
+  }
   std::pair<std::string, double> classificationAndProbability(
       const std::vector<char>& retina
   ) {
-    return this->classificationConfidenceAndProbability(retina).second;
+    return this->classificationAndProbability(Retina(retina));
   }
 
+  // Addresses, RAM counts and scores all live on the thread's scratch buffers, only the returned
+  // class name is allocated
+  std::pair<double, std::pair<std::string, double>> classificationConfidenceAndProbability(
+      const Retina& retina
+  ) {
+    this->addressMapping->checkRetina(retina);
+
+    auto& scratch = getScratch();
+    auto ramsCount = this->addressMapping->getRamsCount();
+    scratch.addresses.resize(ramsCount);
+    this->addressMapping->computeAddresses(retina, scratch.addresses.data());
+
+    if (this->shortlistSize != 0 && this->shortlistSize < this->classNames.size())
+      return this->classifyOnShortlist(scratch.addresses.data(), scratch);
+
+    return this->classifyOnAllClasses(scratch.addresses.data(), scratch);
+  }
   std::pair<double, std::pair<std::string, double>> classificationConfidenceAndProbability(
       const std::vector<char>& retina
   ) {
-    auto result = this->calculateConfidence(this->classificationsProbabilities(retina));
-    if (result.first < this->minimumConfidence) {
-      return {0, {"Not enough confidence to decide", 0}};
-    }
+    return this->classificationConfidenceAndProbability(Retina(retina));
+  }
 
-    return result;
+  // Two stage classification for large vocabularies. Every class is first scored on
+  // coarseRamsCount RAMs only, evenly strided over all of them so each retina region keeps its
+  // share of the votes. The shortlistSize best classes are then scored and bleached in full, the
+  // others left out. A shortlistSize of 0 turns it off.
+  // Decisions only match the full scoring's when its winner is shortlisted, which a larger
+  // shortlistSize makes likelier.
+  // Applies to classify and classificationConfidenceAndProbability, batches and progressive
+  // scoring score every class
+  void setCandidatePruning(size_t shortlistSize, size_t coarseRamsCount) {
+    if (coarseRamsCount == 0)
+      throw std::runtime_error("WiSARD ERROR: Candidate pruning needs at least one coarse RAM.");
+
+    auto ramsCount = this->addressMapping->getRamsCount();
+    coarseRamsCount = std::min(coarseRamsCount, ramsCount);
+
+    this->shortlistSize = shortlistSize;
+    this->coarseRams.clear();
+    if (shortlistSize == 0)
+      return;
+
+    for (size_t index = 0; index != coarseRamsCount; ++index)
+      this->coarseRams.push_back(static_cast<uint32_t>(index * ramsCount / coarseRamsCount));
+  }
+  void setCandidatePruning(size_t shortlistSize) {
+    this->setCandidatePruning(shortlistSize, this->defaultCoarseRamsCount());
+  }
+
+  // A quarter of the RAMs, which on the dataset shortlists nearly as the full votes do, more
+  // coarse RAMs gaining little
+  size_t defaultCoarseRamsCount() const {
+    return std::max(this->addressMapping->getRamsCount() / 4, size_t(1));
   }
 
+  // Counts, on every progressive classification, the RAM probes it left out of all the ones a
+  // full scoring would have taken. Meant for single threaded measurements, see
+  // classifyProgressively
+  void setProgressiveScoringTracking(bool trackProgressiveScoring) {
+    this->trackProgressiveScoring = trackProgressiveScoring;
+  }
+
+  size_t getSkippedRamsCount() const { return this->skippedRamsCount; }
+  size_t getClassifiedRamsCount() const { return this->classifiedRamsCount; }
+
  private:
-  std::unordered_map<std::string, double> applyBleaching(
-      const std::unordered_map<std::string, double>& results,
-      const std::unordered_map<std::string, std::vector<unsigned>>& ramResult,
-      double ramsCount
-  ) {
-    std::unordered_map<std::string, double> bleachedResults = results;
-    auto confidence = this->calculateConfidence(results).first;
-    auto currentBleachingThreshold = this->bleachingThreshold;
+  static constexpr size_t batchBlockSize = 64;
+  static constexpr size_t progressiveChunkSize = 32;
 
-    // First element in bestClass is confidence rating
-    while (confidence < this->minimumConfidence) {
+  static ScoringScratch& getScratch() {
+    static thread_local ScoringScratch scratch;
+    return scratch;
+  }
 
-      double maxValue = 0.0;
-      for (const auto&[className, result] : bleachedResults) {
+  // RAM counts of every class for one retina's addresses, ramsCount counts per class id. Only
+  // RAMs from firstRam to lastRam are probed
+  void probeRams(
+      const size_t* addresses,
+      unsigned* ramResults,
+      size_t firstRam,
+      size_t lastRam
+  ) const {
+    auto ramsCount = this->addressMapping->getRamsCount();
+
+    if (this->storage == Storage::ClassInterleaved) {
+      for (size_t classId = 0; classId != this->classNames.size(); ++classId)
+        std::fill(
+            ramResults + classId * ramsCount + firstRam,
+            ramResults + classId * ramsCount + lastRam,
+            0u
+        );
+
+      // A single lookup per RAM gives the counts of every class
+      for (size_t ramIndex = firstRam; ramIndex != lastRam; ++ramIndex)
+        this->addInterleavedCounts(ramIndex, addresses[ramIndex], ramResults);
+      return;
+    }
 
-        unsigned summedRamsValue = 0;
-        for (size_t index = 0; index != ramResult.at(className).size(); ++index)
-          if (ramResult.at(className)[index] > currentBleachingThreshold)
-            ++summedRamsValue;
+    // Testing with all discriminators
+    for (size_t classId = 0; classId != this->discriminators.size(); ++classId)
+      this->discriminators[classId].classify(
+          addresses,
+          ramResults + classId * ramsCount,
+          firstRam,
+          lastRam
+      );
+  }
 
-        bleachedResults[className] = static_cast<double>(summedRamsValue) / ramsCount;
+  // Scores RAMs a chunk at a time across all classes. A class's final votes lie between the ones
+  // it has and those plus the RAMs left, so once the leader's votes so far keep its confidence
+  // over minimumConfidence whatever the RAMs left say, no class can overtake it and the decision
+  // is the one the full scoring takes. Bleaching only runs when that confidence is below
+  // minimumConfidence, so it never would have. Retinas it can't settle early, including the ones
+  // bleaching decides, are scored in full
+  std::string classifyProgressively(const Retina& retina) {
+    this->addressMapping->checkRetina(retina);
+
+    auto& scratch = getScratch();
+    auto ramsCount = this->addressMapping->getRamsCount();
+    auto classesCount = this->classNames.size();
+    scratch.addresses.resize(ramsCount);
+    scratch.ramResults.resize(classesCount * ramsCount);
+    scratch.votes.assign(classesCount, 0);
+    this->addressMapping->computeAddresses(retina, scratch.addresses.data());
+    if (this->trackProgressiveScoring)
+      this->classifiedRamsCount += classesCount * ramsCount;
+
+    // The leader's votes, at most the RAMs probed, must outnumber the RAMs left, so nothing is
+    // settled before half of them are probed
+    auto ramResults = scratch.ramResults.data();
+    for (size_t firstRam = 0, lastRam = (ramsCount + 1) / 2;
+         firstRam != ramsCount;
+         firstRam = lastRam, lastRam = std::min(lastRam + progressiveChunkSize, ramsCount)) {
+      this->probeRams(scratch.addresses.data(), ramResults, firstRam, lastRam);
+
+      auto leader = noClass;
+      unsigned leaderVotes = 0;
+      unsigned runnerUpVotes = 0;
+      for (size_t classId = 0; classId != classesCount; ++classId) {
+        auto votes = scratch.votes[classId];
+        for (size_t ramIndex = firstRam; ramIndex != lastRam; ++ramIndex)
+          votes += ramResults[classId * ramsCount + ramIndex] > 0;
+        scratch.votes[classId] = votes;
+
+        if (leader == noClass || votes > leaderVotes) {
+          runnerUpVotes = leaderVotes;
+          leaderVotes = votes;
+          leader = classId;
+        } else if (votes > runnerUpVotes) {
+          runnerUpVotes = votes;
+        }
+      }
 
-        if ((result - maxValue) > 0.0001)
-          maxValue = result;
+      auto ramsLeft = ramsCount - lastRam;
+      if (ramsLeft == 0 || leaderVotes == 0)
+        continue;
+
+      // The same arithmetic calculateConfidence takes, on the worst final scores
+      auto leaderScore = static_cast<double>(leaderVotes) / static_cast<double>(ramsCount);
+      auto runnerUpScore = classesCount > 1
+                           ? static_cast<double>(runnerUpVotes + ramsLeft)
+                               / static_cast<double>(ramsCount)
+                           : 0.0;
+      if (runnerUpScore < leaderScore
+          && 1.0 - runnerUpScore / leaderScore >= this->minimumConfidence) {
+        if (this->trackProgressiveScoring)
+          this->skippedRamsCount += classesCount * ramsLeft;
+        return this->classNames[leader];
       }
+    }
+
+    // Every RAM was probed, the votes give the unbleached scores
+    scratch.scores.resize(classesCount);
+    for (size_t classId = 0; classId != classesCount; ++classId)
+      scratch.scores[classId] =
+          static_cast<double>(scratch.votes[classId]) / static_cast<double>(ramsCount);
+
+    return this->decide(
+        this->bleachScores(ramResults, classesCount, ramsCount, scratch),
+        classesCount
+    ).second.first;
+  }
+
+  std::pair<double, std::pair<std::string, double>> classifyOnAllClasses(
+      const size_t* addresses,
+      ScoringScratch& scratch
+  ) const {
+    auto ramsCount = this->addressMapping->getRamsCount();
+    auto classesCount = this->classNames.size();
+    scratch.ramResults.resize(classesCount * ramsCount);
+    this->probeRams(addresses, scratch.ramResults.data(), 0, ramsCount);
+
+    return this->decide(
+        this->scoreClasses(scratch.ramResults.data(), classesCount, scratch),
+        classesCount
+    );
+  }
 
-      // If no ram recognizes the pattern, return previous value
-      if (maxValue <= 0.000001) {
-        return results;
+  // See setCandidatePruning
+  std::pair<double, std::pair<std::string, double>> classifyOnShortlist(
+      const size_t* addresses,
+      ScoringScratch& scratch
+  ) const {
+    auto ramsCount = this->addressMapping->getRamsCount();
+    auto classesCount = this->classNames.size();
+
+    // Coarse RAM counts of every class
+    auto coarseRamsCount = this->coarseRams.size();
+    auto& coarseResults = scratch.coarseResults;
+    coarseResults.resize(classesCount * coarseRamsCount);
+    if (this->storage == Storage::ClassInterleaved) {
+      std::fill(coarseResults.begin(), coarseResults.end(), 0u);
+      for (size_t index = 0; index != coarseRamsCount; ++index) {
+        auto ramIndex = this->coarseRams[index];
+        for (const auto& classCount : this->interleavedRams[ramIndex].get(addresses[ramIndex]))
+          coarseResults[classCount.classId * coarseRamsCount + index] = classCount.count;
       }
+    } else {
+      for (size_t classId = 0; classId != classesCount; ++classId)
+        this->discriminators[classId].classify(
+            addresses,
+            this->coarseRams.data(),
+            coarseRamsCount,
+            coarseResults.data() + classId * coarseRamsCount
+        );
+    }
 
-      ++currentBleachingThreshold;
-      confidence = this->calculateConfidence(bleachedResults).first;
+    // Most voted classes. The full scoring only bleaches when its best votes nearly tie, so ties
+    // on coarse votes break on the coarse scores bleaching leaves, then by class id as on a full
+    // scoring
+    const auto* bleachedScores =
+        this->scoreClasses(coarseResults.data(), classesCount, coarseRamsCount, scratch);
+    auto& shortlist = scratch.shortlist;
+    shortlist.resize(classesCount);
+    for (size_t classId = 0; classId != classesCount; ++classId)
+      shortlist[classId] = static_cast<uint32_t>(classId);
+    std::partial_sort(
+        shortlist.begin(),
+        shortlist.begin() + this->shortlistSize,
+        shortlist.end(),
+        [&scores = scratch.scores, bleachedScores](uint32_t first, uint32_t second) {
+          if (scores[first] != scores[second])
+            return scores[first] > scores[second];
+          if (bleachedScores[first] != bleachedScores[second])
+            return bleachedScores[first] > bleachedScores[second];
+          return first < second;
+        }
+    );
+    shortlist.resize(this->shortlistSize);
+    std::sort(shortlist.begin(), shortlist.end());
+
+    // RAM counts of the shortlisted classes, in shortlist order
+    scratch.ramResults.resize(this->shortlistSize * ramsCount);
+    auto ramResults = scratch.ramResults.data();
+    if (this->storage == Storage::ClassInterleaved) {
+      scratch.shortlistIndices.assign(classesCount, noShortlistIndex);
+      for (size_t index = 0; index != shortlist.size(); ++index)
+        scratch.shortlistIndices[shortlist[index]] = static_cast<uint32_t>(index);
+
+      std::fill(scratch.ramResults.begin(), scratch.ramResults.end(), 0u);
+      for (size_t ramIndex = 0; ramIndex != ramsCount; ++ramIndex)
+        for (const auto& classCount : this->interleavedRams[ramIndex].get(addresses[ramIndex])) {
+          auto index = scratch.shortlistIndices[classCount.classId];
+          if (index != noShortlistIndex)
+            ramResults[index * ramsCount + ramIndex] = classCount.count;
+        }
+    } else {
+      for (size_t index = 0; index != shortlist.size(); ++index)
+        this->discriminators[shortlist[index]].classify(addresses, ramResults + index * ramsCount);
     }
 
-    return bleachedResults;
+    return this->decide(
+        this->scoreClasses(ramResults, this->shortlistSize, scratch),
+        this->shortlistSize,
+        shortlist.data()
+    );
+  }
+
+  // Adds the counts of every class on an interleaved RAM address to their RAM results
+  void addInterleavedCounts(size_t ramIndex, size_t address, unsigned* ramResults) const {
+    auto ramsCount = this->addressMapping->getRamsCount();
+    for (const auto& classCount : this->interleavedRams[ramIndex].get(address))
+      ramResults[classCount.classId * ramsCount + ramIndex] = classCount.count;
   }
 
-  static std::pair<double, std::pair<std::string, double>> calculateConfidence(
-      const std::unordered_map<std::string, double>& classificationsProbabilitiesResult
-  ) {
-    std::string bestClass;
+  // Probes addresses in blocks, RAM major, handing the scores of each retina to onScores in order
+  template<typename OnScores>
+  void scoreBatch(const std::vector<RamAddresses>& addresses, OnScores&& onScores) {
+    for (const auto& retinaAddresses : addresses)
+      this->addressMapping->checkAddresses(retinaAddresses);
+
+    auto& scratch = getScratch();
+    auto ramsCount = this->addressMapping->getRamsCount();
+    auto classesCount = this->classNames.size();
+    auto retinaResultsSize = classesCount * ramsCount;
+
+    // A single interleaved lookup already answers for every class, independent lookups overlap
+    // without prefetching and the counts of a block of retinas outgrow the cache, which made
+    // blocks slower than probing each retina on its own
+    if (this->storage == Storage::ClassInterleaved) {
+      scratch.ramResults.resize(retinaResultsSize);
+      for (const auto& retinaAddresses : addresses) {
+        this->probeRams(retinaAddresses.data(), scratch.ramResults.data(), 0, ramsCount);
+        onScores(this->scoreClasses(scratch.ramResults.data(), classesCount, scratch));
+      }
+      return;
+    }
+
+    // Blocks bound the RAM counts kept at once
+    for (size_t first = 0; first < addresses.size(); first += batchBlockSize) {
+      auto blockSize = std::min(batchBlockSize, addresses.size() - first);
+      scratch.ramResults.resize(blockSize * retinaResultsSize);
+
+      for (size_t classId = 0; classId != classesCount; ++classId)
+        this->discriminators[classId].classifyBatch(
+            addresses.data() + first,
+            blockSize,
+            scratch.ramResults.data() + classId * ramsCount,
+            retinaResultsSize
+        );
+
+      for (size_t index = 0; index != blockSize; ++index) {
+        auto ramResults = scratch.ramResults.data() + index * retinaResultsSize;
+        onScores(this->scoreClasses(ramResults, classesCount, scratch));
+      }
+    }
+  }
+
+  // Probability of each class id, the share of its RAMs recognizing the retina, bleached when
+  // confidence is too low. Points to one of the scratch score buffers
+  const double* scoreClasses(
+      const unsigned* ramResults,
+      size_t classesCount,
+      ScoringScratch& scratch
+  ) const {
+    return this->scoreClasses(
+        ramResults,
+        classesCount,
+        this->addressMapping->getRamsCount(),
+        scratch
+    );
+  }
+
+  // Scores out of ramsCount counts per class, a subset of the RAMs when candidate pruning
+  const double* scoreClasses(
+      const unsigned* ramResults,
+      size_t classesCount,
+      size_t ramsCount,
+      ScoringScratch& scratch
+  ) const {
+    scratch.scores.resize(classesCount);
+    for (size_t classId = 0; classId != classesCount; ++classId)
+      scratch.scores[classId] = this->countVotes(ramResults + classId * ramsCount, ramsCount, 0);
+
+    return this->bleachScores(ramResults, classesCount, ramsCount, scratch);
+  }
+
+  const double* bleachScores(
+      const unsigned* ramResults,
+      size_t classesCount,
+      size_t ramsCount,
+      ScoringScratch& scratch
+  ) const {
+    if (!this->useBleaching)
+      return scratch.scores.data();
+
+    return this->applyBleaching(ramResults, classesCount, ramsCount, scratch);
+  }
+
+  // Share of ramsCount counts above threshold
+  double countVotes(const unsigned* ramResult, size_t ramsCount, unsigned threshold) const {
+    size_t positiveVotes = 0;
+    for (size_t ramIndex = 0; ramIndex != ramsCount; ++ramIndex)
+      if (ramResult[ramIndex] > threshold)
+        ++positiveVotes;
+
+    return static_cast<double>(positiveVotes) / static_cast<double>(ramsCount);
+  }
+
+  // Bleaching counts a RAM vote only when its count is above a threshold, raised from
+  // bleachingThreshold until confidence reaches minimumConfidence. Votes at every threshold come
+  // from a single pass over the RAM counts, so the cost is bounded whatever their magnitude:
+  // a per class histogram of the counts when they are small, the counts sorted otherwise.
+  // Confidence isn't monotone on the threshold, so the first one reaching minimumConfidence is
+  // searched in order, not bisected
+  const double* applyBleaching(
+      const unsigned* ramResults,
+      size_t classesCount,
+      size_t ramsCount,
+      ScoringScratch& scratch
+  ) const {
+    const auto* results = scratch.scores.data();
+
+    // An untrained model has no RAM counts to bleach
+    if (classesCount == 0)
+      return results;
+
+    if (this->calculateConfidence(results, classesCount).confidence >= this->minimumConfidence)
+      return results;
+
+    // No RAM votes above bleachingThreshold
+    auto maxCount = *std::max_element(ramResults, ramResults + classesCount * ramsCount);
+    if (maxCount <= this->bleachingThreshold)
+      return results;
+
+    scratch.votes.resize(classesCount);
+    scratch.bleachedScores.resize(classesCount);
+    auto valuesCount = static_cast<size_t>(maxCount - this->bleachingThreshold);
+    if (valuesCount <= ramsCount)
+      return this->bleachFromHistogram(
+          ramResults,
+          results,
+          classesCount,
+          ramsCount,
+          valuesCount,
+          scratch
+      );
+
+    return this->bleachFromSortedCounts(ramResults, results, classesCount, ramsCount, scratch);
+  }
+
+  // Histogram bin v of a class holds its counts equal to bleachingThreshold + v, bin 0 those not
+  // above bleachingThreshold. Raising the threshold by one drops the next bin's votes
+  const double* bleachFromHistogram(
+      const unsigned* ramResults,
+      const double* results,
+      size_t classesCount,
+      size_t ramsCount,
+      size_t valuesCount,
+      ScoringScratch& scratch
+  ) const {
+    auto binsCount = valuesCount + 1;
+
+    auto& histogram = scratch.histogram;
+    histogram.assign(classesCount * binsCount, 0);
+    for (size_t classId = 0; classId != classesCount; ++classId) {
+      auto classHistogram = histogram.data() + classId * binsCount;
+      for (size_t ramIndex = 0; ramIndex != ramsCount; ++ramIndex) {
+        auto count = ramResults[classId * ramsCount + ramIndex];
+        ++classHistogram[count > this->bleachingThreshold ? count - this->bleachingThreshold : 0];
+      }
+      scratch.votes[classId] = static_cast<unsigned>(ramsCount - classHistogram[0]);
+    }
+
+    // Every vote is gone once the threshold reaches the largest count, ending the search
+    for (size_t value = 1;; ++value) {
+      if (auto scores = this->bleachingStep(results, classesCount, ramsCount, scratch))
+        return scores;
+
+      for (size_t classId = 0; classId != classesCount; ++classId)
+        scratch.votes[classId] -= histogram[classId * binsCount + value];
+    }
+  }
+
+  // Counts above bleachingThreshold, sorted, are dropped a distinct count at a time
+  const double* bleachFromSortedCounts(
+      const unsigned* ramResults,
+      const double* results,
+      size_t classesCount,
+      size_t ramsCount,
+      ScoringScratch& scratch
+  ) const {
+    auto& counts = scratch.bleachingCounts;
+    counts.clear();
+    std::fill(scratch.votes.begin(), scratch.votes.end(), 0u);
+    for (size_t classId = 0; classId != classesCount; ++classId)
+      for (size_t ramIndex = 0; ramIndex != ramsCount; ++ramIndex) {
+        auto count = ramResults[classId * ramsCount + ramIndex];
+        if (count > this->bleachingThreshold) {
+          ++scratch.votes[classId];
+          counts.push_back(ClassCount{static_cast<uint32_t>(classId), count});
+        }
+      }
+
+    std::sort(counts.begin(), counts.end(), [](const ClassCount& first, const ClassCount& second) {
+      return first.count < second.count;
+    });
+
+    for (auto nextCount = counts.begin();;) {
+      if (auto scores = this->bleachingStep(results, classesCount, ramsCount, scratch))
+        return scores;
+
+      auto threshold = nextCount->count;
+      for (; nextCount != counts.end() && nextCount->count == threshold; ++nextCount)
+        --scratch.votes[nextCount->classId];
+    }
+  }
+
+  // Scores out of the current bleaching votes. They are returned once they reach
+  // minimumConfidence, the unbleached results once no RAM recognizes the pattern, and nullptr
+  // while the threshold must go on rising
+  const double* bleachingStep(
+      const double* results,
+      size_t classesCount,
+      size_t ramsCount,
+      ScoringScratch& scratch
+  ) const {
+    double maxValue = 0.0;
+    for (size_t classId = 0; classId != classesCount; ++classId) {
+      auto result = static_cast<double>(scratch.votes[classId]) / static_cast<double>(ramsCount);
+      scratch.bleachedScores[classId] = result;
+
+      if ((result - maxValue) > 0.0001)
+        maxValue = result;
+    }
+
+    // If no ram recognizes the pattern, return previous value
+    if (maxValue <= 0.000001)
+      return results;
+
+    if (this->calculateConfidence(scratch.bleachedScores.data(), classesCount).confidence
+        >= this->minimumConfidence)
+      return scratch.bleachedScores.data();
+
+    return nullptr;
+  }
+
+  // Best class and how far ahead of the second best it is. Ties go to the lowest class id
+  Decision calculateConfidence(const double* scores, size_t classesCount) const {
+    size_t bestClass = noClass;
     double max = 0.0;
     double secondMax = 0.0;
 
-    for (const auto&[className, probability] : classificationsProbabilitiesResult) {
+    for (size_t classId = 0; classId != classesCount; ++classId) {
+      auto probability = scores[classId];
       if (max < probability) {
         secondMax = max;
         max = probability;
-        bestClass = className;
+        bestClass = classId;
       } else if (secondMax < probability)
         secondMax = probability;
     }
 
     double confidence = max != 0.0 ? 1.0 - secondMax / max : 0.0;
-    // First value is confidence, second is a pair with best class name and it's probability
-    return {confidence, {bestClass, max}};
+    return {confidence, bestClass, max};
+  }
+
+  // First value is confidence, second is a pair with best class name and it's probability.
+  // Scores of a shortlist come with the class id of each one
+  std::pair<double, std::pair<std::string, double>> decide(
+      const double* scores,
+      size_t classesCount,
+      const uint32_t* scoredClassIds = nullptr
+  ) const {
+    auto decision = this->calculateConfidence(scores, classesCount);
+    if (decision.confidence < this->minimumConfidence)
+      return {0, std::pair<std::string, double>("Not enough confidence to decide", 0)};
+
+    auto classId = scoredClassIds != nullptr && decision.classId != noClass
+                   ? scoredClassIds[decision.classId]
+                   : decision.classId;
+    return {
+        decision.confidence,
+        std::pair<std::string, double>(
+            classId != noClass ? this->classNames[classId] : std::string(),
+            decision.probability
+        )
+    };
+  }
+
+  std::unordered_map<std::string, double> namedProbabilities(const double* scores) const {
+    std::unordered_map<std::string, double> result(this->classNames.size());
+    for (size_t classId = 0; classId != this->classNames.size(); ++classId)
+      result[this->classNames[classId]] = scores[classId];
+
+    return result;
   }
 
 };
@@ -0,0 +1,19 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 03/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_X86DISPATCH_H
+#define DICTAWAV_X86DISPATCH_H
+
+// Kernels built with __attribute__((target)) and picked at runtime with __builtin_cpu_supports,
+// which needs GCC or Clang on x86
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define DICTAWAV_X86_DISPATCH 1
+#endif
+
+#endif //DICTAWAV_X86DISPATCH_H
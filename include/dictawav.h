@@ -13,16 +13,28 @@
 #include <fstream>
 #include <string>
 #include "wav_handler/WavHandler.h"
+#include "preprocessor/VoiceActivityDetector.h"
 #include "preprocessor/PreProcessor.h"
 #include "classificator/KernelCanvas.h"
 #include "classificator/Wisard.h"
 
 namespace DictaWav {
 
+// Sample type used on the whole feature pipeline, building with DICTAWAV_SINGLE_PRECISION halves
+// memory traffic and doubles SIMD width by running it on float
+#if defined(DICTAWAV_SINGLE_PRECISION)
+using DefaultSample = float;
+#else
+using DefaultSample = double;
+#endif
+
+template<typename Sample = DefaultSample>
 class DictaWav {
  private:
-  KernelCanvas kernelCanvas;
+  KernelCanvas<Sample> kernelCanvas;
   Wisard wisard;
+  bool trimSilence;
+  size_t trimmedFramesCount = 0;
 
  public:
   DictaWav(
@@ -35,12 +47,21 @@ class DictaWav {
       double wisardConfidenceMinimumRate = 0.1,
       unsigned wisardBleachingThreshold = 1,
       bool wisardRandomizePositions = true,
-      bool wisardIsCumulative = true
+      bool wisardIsCumulative = true,
+      bool trimSilence = false,
+      typename KernelCanvas<Sample>::SearchMode kernelCanvasSearchMode =
+          KernelCanvas<Sample>::SearchMode::Batched,
+      size_t kernelCanvasRerankCount = QuantizedKernelIndex<Sample>::defaultRerankCount,
+      Wisard::Storage wisardStorage = Wisard::Storage::PerClass,
+      RamBackend wisardRamBackend = RamBackend::HashMap,
+      bool wisardProgressiveScoring = false
   ) :
       kernelCanvas(
           kernelCanvasNumKernels,
           kernelCanvasKernelDimension,
-          kernelCanvasOutputFactor
+          kernelCanvasOutputFactor,
+          kernelCanvasSearchMode,
+          kernelCanvasRerankCount
       ),
       wisard(
           wisardRetinaSize,
@@ -49,8 +70,16 @@ class DictaWav {
           wisardConfidenceMinimumRate,
           wisardBleachingThreshold,
           wisardRandomizePositions,
-          wisardIsCumulative
-      ) {}
+          wisardIsCumulative,
+          static_cast<size_t>(kernelCanvasOutputFactor),
+          wisardStorage,
+          wisardRamBackend,
+          wisardProgressiveScoring
+      ),
+      trimSilence(trimSilence) {
+    // Loading FFTW wisdom once at startup, instead of on the first file to be processed
+    FFTWPlanRegistry<Sample>::getInstance();
+  }
 
   void train(std::string wavTrainingFile, std::string className) {
     this->wisard.train(this->readAndProcessWavFile(wavTrainingFile), className);
@@ -64,6 +93,16 @@ class DictaWav {
     return this->wisard.classify(this->readAndProcessWavFile(wavFileToClassify));
   }
 
+  // Reads every file first, then classifies them all at once, see Wisard::classifyBatch
+  std::vector<std::string> classifyBatch(const std::vector<std::string>& wavFilesToClassify) {
+    std::vector<Retina> retinas;
+    retinas.reserve(wavFilesToClassify.size());
+    for (const auto& wavFile : wavFilesToClassify)
+      retinas.push_back(this->readAndProcessWavFile(wavFile));
+
+    return this->wisard.classifyBatch(retinas);
+  }
+
   std::pair<std::string, double> classificationAndProbability(std::string wavFileToClassify) {
     return this->wisard.classificationAndProbability(
         this->readAndProcessWavFile(wavFileToClassify)
@@ -77,15 +116,56 @@ class DictaWav {
                .classificationConfidenceAndProbability(this->readAndProcessWavFile(wavFiletoClassify));
   }
 
+  // Voice activity detector frames dropped as silence on all files read so far
+  size_t getTrimmedFramesCount() const { return this->trimmedFramesCount; }
+
+  KernelCanvas<Sample>& getKernelCanvas() { return this->kernelCanvas; }
+
+  Wisard& getWisard() { return this->wisard; }
+
+  // Retina painted for a wav file, for it to be handed to the Wisard directly
+  Retina paintRetina(const std::string& wavFile) { return this->readAndProcessWavFile(wavFile); }
+
  private:
-  std::vector<char> readAndProcessWavFile(std::string wavFile) {
-    WavHandler wavHandler(wavFile);
-    PreProcessor preProcessor(wavHandler.getSampleRate());
-    preProcessor.process(wavHandler.getAudioData());
+  Retina readAndProcessWavFile(std::string wavFile) {
+    WavHandler<Sample> wavHandler(wavFile, true);
+    PreProcessor<Sample> preProcessor(
+        wavHandler.getSampleRate(),
+        PreProcessor<Sample>::defaultFramesPerBatch
+    );
+
+    auto processChunk = [&preProcessor](const Sample* samples, size_t samplesCount) {
+      preProcessor.processChunk(samples, samplesCount);
+    };
 
-    this->kernelCanvas.process(preProcessor.extractProcessedFrames());
+    // Decoded blocks are fed straight to the PreProcessor, never holding the whole file in memory
+    if (this->trimSilence) {
+      VoiceActivityDetector<Sample> voiceActivityDetector(wavHandler.getSampleRate());
+      wavHandler.streamAudioData([&](const Sample* samples, size_t samplesCount) {
+        voiceActivityDetector.processChunk(samples, samplesCount, processChunk);
+      });
+      voiceActivityDetector.finish(processChunk);
+
+      // A file with no speech at all is processed whole instead of becoming an empty canvas
+      if (!voiceActivityDetector.foundSpeech())
+        WavHandler<Sample>(wavFile, true).streamAudioData(processChunk);
+      else
+        this->trimmedFramesCount += voiceActivityDetector.getTrimmedFramesCount();
+    } else {
+      wavHandler.streamAudioData(processChunk);
+    }
+    preProcessor.finish();
+
+    // Features matrix goes to the canvas as is, without splitting it into a vector per frame
+    auto coefficientsCount = preProcessor.getCoefficientsCount();
+    auto features = preProcessor.extractProcessedFeatures();
+    this->kernelCanvas.process(
+        features.data(),
+        features.size() / coefficientsCount,
+        coefficientsCount
+    );
 
-    return this->kernelCanvas.getPaintedCanvas();
+    return this->kernelCanvas.getPaintedRetina();
   }
 };
 
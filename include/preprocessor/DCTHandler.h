@@ -12,67 +12,75 @@
 #include <stdexcept>
 #include <vector>
 #include <cmath>
-#include <fftw3.h>
+#include "FFTWPlanRegistry.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
 class DCTHandler {
-  fftw_plan dct;
-  size_t size;
-  double* input;
-  double* output;
+  using FFTW = FFTWTraits<Sample>;
+  using PlanRegistry = FFTWPlanRegistry<Sample>;
 
-  const char* wisdomFileName = "./fftWisdomFile.data";
+  typename FFTW::Plan dct;
+  typename FFTW::Plan batchDct;
+  size_t size;
+  size_t batchSize;
+  // Both buffers are batchSize contiguous rows with size elements each
+  Sample* input;
+  Sample* output;
 
  public:
-  DCTHandler(size_t size) :
+  explicit DCTHandler(size_t size, size_t batchSize = 1) :
       size(size),
-      input(fftw_alloc_real(size)),
-      output(fftw_alloc_real(size)) {
-    fftw_import_wisdom_from_filename(this->wisdomFileName);
-
-    this->dct = fftw_plan_r2r_1d(
-        size,
-        input,
-        output,
-        FFTW_REDFT10,
-        FFTW_PATIENT | FFTW_DESTROY_INPUT
-    );
-
-    if (this->dct == NULL) {
-      throw std::runtime_error("FFTW3 error: Couldn't make plans for DCT");
-    }
-
-    if (!fftw_export_wisdom_to_filename(this->wisdomFileName)) {
-      throw std::runtime_error("FFTW3 error: Couldn't save wisdom to file");
-    }
-
-    for (size_t index = 0; index != size; ++index) {
-      this->input[index] = 0.0;
-      this->output[index] = 0.0;
+      batchSize(batchSize),
+      input(FFTW::allocReal(size * batchSize)),
+      output(FFTW::allocReal(size * batchSize)) {
+    // Plans are owned by the registry and shared with every other DCTHandler of the same size
+    auto& planRegistry = PlanRegistry::getInstance();
+    this->dct = planRegistry.getPlan(PlanRegistry::TransformKind::DCT2, size);
+    this->batchDct = batchSize > 1
+                     ? planRegistry.getPlan(PlanRegistry::TransformKind::DCT2, size, batchSize)
+                     : this->dct;
+
+    for (size_t index = 0; index != size * batchSize; ++index) {
+      this->input[index] = Sample(0);
+      this->output[index] = Sample(0);
     }
   }
 
   ~DCTHandler() {
-    fftw_free(this->input);
-    fftw_free(this->output);
-    fftw_destroy_plan(this->dct);
+    FFTW::free(this->input);
+    FFTW::free(this->output);
   }
 
-  std::vector<double> process(const std::vector<double>& input) {
-    for (auto pos = 0; pos != this->size; ++pos)
-      this->input[pos] = input[pos];
+  // Deleted copy constructor and operator
+  DCTHandler(const DCTHandler&) = delete;
+  DCTHandler& operator=(const DCTHandler&) = delete;
 
-    fftw_execute(this->dct);
+  // Input buffer, to be filled before calling process
+  Sample* getInput() { return this->input; }
 
-    std::vector<double> frame;
-    frame.reserve(this->size / 2);
-    for (auto pos = 0; pos != this->size / 2; ++pos) {
-      frame.push_back(this->output[pos]);
-      this->output[pos] = 0.0;
-    }
+  // Transforms the input buffer, writing its first size / 2 coefficients on coefficients
+  void process(Sample* coefficients) {
+    FFTW::executeR2R(this->dct, this->input, this->output);
+
+    for (size_t pos = 0; pos != this->size / 2; ++pos)
+      coefficients[pos] = this->output[pos];
+  }
+
+  // Row of the batch input matrix, to be filled before calling processBatch
+  Sample* getBatchInput(size_t row) { return this->input + row * this->size; }
+
+  // Transforms the whole batch with a single FFTW call, writing size / 2 coefficients for each one
+  // of the first rowsCount rows on coefficients. Rows beyond rowsCount are also transformed, but
+  // their results are ignored
+  void processBatch(size_t rowsCount, Sample* coefficients) {
+    FFTW::executeR2R(this->batchDct, this->input, this->output);
 
-    return std::move(frame);
+    auto coefficientsCount = this->size / 2;
+    for (size_t row = 0; row != rowsCount; ++row)
+      for (size_t pos = 0; pos != coefficientsCount; ++pos)
+        coefficients[row * coefficientsCount + pos] = this->output[row * this->size + pos];
   }
 };
 
@@ -12,73 +12,110 @@
 #include <stdexcept>
 #include <vector>
 #include <cmath>
-#include <fftw3.h>
+#include "FFTWPlanRegistry.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
 class FFTHandler {
-  fftw_plan fft;
-  size_t size;
-  fftw_complex* input;
-  fftw_complex* output;
+  using FFTW = FFTWTraits<Sample>;
+  using PlanRegistry = FFTWPlanRegistry<Sample>;
+  using Complex = typename FFTW::Complex;
 
-  const char* wisdomFileName = "./fftWisdomFile.data";
+ public:
+  enum class SpectrumType {
+    Magnitude, // |X[k]|
+    Power      // |X[k]|^2
+  };
+
+ private:
+  typename FFTW::Plan fft;
+  typename FFTW::Plan batchFft;
+  size_t size;
+  size_t spectrumSize;
+  size_t batchSize;
+  SpectrumType spectrumType;
+  // batchSize contiguous rows, with size real inputs and spectrumSize complex outputs each
+  Sample* input;
+  Complex* output;
 
  public:
-  FFTHandler(size_t size) : size(size),
-                            input(fftw_alloc_complex(size)),
-                            output(fftw_alloc_complex(size)) {
-    fftw_import_wisdom_from_filename(this->wisdomFileName);
-
-    this->fft = fftw_plan_dft_1d(
-        size,
-        input,
-        output,
-        FFTW_FORWARD,
-        FFTW_PATIENT | FFTW_DESTROY_INPUT
-    );
-
-    if (this->fft == NULL) {
-      throw std::runtime_error("FFTW3 error: Couldn't make plans for FFT");
-    }
-
-    if (!fftw_export_wisdom_to_filename(this->wisdomFileName)) {
-      throw std::runtime_error("FFTW3 error: Couldn't save wisdom to file");
-    }
-
-    for (size_t index = 0; index != size; ++index) {
-      this->input[index][0] = 0.0;
-      this->input[index][1] = 0.0;
-      this->output[index][0] = 0.0;
-      this->output[index][1] = 0.0;
-    }
+  // Audio is real, so a real to complex transform is used and only the size / 2 + 1 non redundant
+  // bins, from DC up to Nyquist, are computed
+  explicit FFTHandler(
+      size_t size,
+      SpectrumType spectrumType = SpectrumType::Magnitude,
+      size_t batchSize = 1
+  ) :
+      size(size),
+      spectrumSize(size / 2 + 1),
+      batchSize(batchSize),
+      spectrumType(spectrumType),
+      input(FFTW::allocReal(size * batchSize)),
+      output(FFTW::allocComplex((size / 2 + 1) * batchSize)) {
+    // Plans are owned by the registry and shared with every other FFTHandler of the same size
+    auto& planRegistry = PlanRegistry::getInstance();
+    this->fft = planRegistry.getPlan(PlanRegistry::TransformKind::RealForward, size);
+    this->batchFft =
+        batchSize > 1
+        ? planRegistry.getPlan(PlanRegistry::TransformKind::RealForward, size, batchSize)
+        : this->fft;
+
+    for (size_t index = 0; index != size * batchSize; ++index)
+      this->input[index] = Sample(0);
   }
 
   ~FFTHandler() {
-    fftw_free(this->input);
-    fftw_free(this->output);
-    fftw_destroy_plan(this->fft);
+    FFTW::free(this->input);
+    FFTW::free(this->output);
+  }
+
+  // Deleted copy constructor and operator
+  FFTHandler(const FFTHandler&) = delete;
+  FFTHandler& operator=(const FFTHandler&) = delete;
+
+  size_t getSpectrumSize() const { return this->spectrumSize; }
+
+  // Input buffer, to be filled with a frame before calling process
+  Sample* getInput() { return this->input; }
+
+  // Transforms the input buffer, writing getSpectrumSize() values on spectrum
+  void process(Sample* spectrum) {
+    FFTW::executeDftR2C(this->fft, this->input, this->output);
+
+    this->writeSpectrum(this->output, spectrum);
+  }
+
+  // Row of the batch input matrix, to be filled before calling processBatch
+  Sample* getBatchInput(size_t row) { return this->input + row * this->size; }
+
+  // Transforms the whole batch with a single FFTW call, writing getSpectrumSize() values for each
+  // one of the first rowsCount rows on spectra. Rows beyond rowsCount are also transformed, but
+  // their results are ignored
+  void processBatch(size_t rowsCount, Sample* spectra) {
+    FFTW::executeDftR2C(this->batchFft, this->input, this->output);
+
+    for (size_t row = 0; row != rowsCount; ++row)
+      this->writeSpectrum(
+          this->output + row * this->spectrumSize,
+          spectra + row * this->spectrumSize
+      );
   }
 
-  std::vector<double> process(const std::vector<double>& input) {
-    for (auto pos = 0; pos != this->size; ++pos) {
-      this->input[pos][0] = input[pos];
-      this->input[pos][1] = 0.0;
-    }
-
-    fftw_execute(this->fft);
-
-    std::vector<double> frame;
-    frame.reserve(this->size);
-
-    for (auto pos = 0; pos != this->size; ++pos) {
-      double real = this->output[pos][0];
-      double imaginary = this->output[pos][1];
-      this->output[pos][0] = 0.0;
-      this->output[pos][1] = 0.0;
-      frame.push_back(std::sqrt((real * real) + (imaginary * imaginary)));
-    }
-    return std::move(frame);
+ private:
+  void writeSpectrum(const Complex* bins, Sample* spectrum) {
+    if (this->spectrumType == SpectrumType::Power)
+      for (size_t pos = 0; pos != this->spectrumSize; ++pos) {
+        Sample real = bins[pos][0];
+        Sample imaginary = bins[pos][1];
+        spectrum[pos] = (real * real) + (imaginary * imaginary);
+      }
+    else
+      for (size_t pos = 0; pos != this->spectrumSize; ++pos) {
+        Sample real = bins[pos][0];
+        Sample imaginary = bins[pos][1];
+        spectrum[pos] = std::sqrt((real * real) + (imaginary * imaginary));
+      }
   }
 };
 
@@ -0,0 +1,126 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 07/02/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_FFTWPLANREGISTRY_H
+#define DICTAWAV_FFTWPLANREGISTRY_H
+
+#include <stdexcept>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "FFTWTraits.h"
+
+namespace DictaWav {
+
+// Process wide cache of FFTW plans, one per sample type. Each (transform kind, size, batch) is
+// planned only once and shared by every handler, which must run it through the new-array execute
+// functions with their own buffers, allocated through FFTWTraits so they have the same alignment as
+// the ones used for planning. FFTW planner isn't thread safe, so planning is serialized, while
+// executing plans is.
+template<typename Sample>
+class FFTWPlanRegistry {
+ public:
+  using FFTW = FFTWTraits<Sample>;
+  using Plan = typename FFTW::Plan;
+
+  enum class TransformKind {
+    RealForward,    // r2c DFT
+    DCT2            // r2r with FFTW_REDFT10
+  };
+
+ private:
+  std::mutex planningMutex;
+  std::map<std::tuple<TransformKind, size_t, size_t>, Plan> plans;
+
+  static constexpr unsigned planningFlags = FFTW_PATIENT | FFTW_DESTROY_INPUT;
+
+  // Wisdom is loaded only once, when the registry is first used
+  FFTWPlanRegistry() {
+    FFTW::importWisdom();
+  }
+
+ public:
+  ~FFTWPlanRegistry() {
+    for (auto& [key, plan] : this->plans)
+      FFTW::destroyPlan(plan);
+  }
+
+  // Deleted copy constructor and operator
+  FFTWPlanRegistry(const FFTWPlanRegistry&) = delete;
+  FFTWPlanRegistry& operator=(const FFTWPlanRegistry&) = delete;
+
+  static FFTWPlanRegistry& getInstance() {
+    static FFTWPlanRegistry registry;
+    return registry;
+  }
+
+  // Plans with batchCount greater than 1 run batchCount transforms over contiguous rows, each row
+  // with size elements for input and output, except for RealForward output rows, which have
+  // size / 2 + 1 complex elements
+  Plan getPlan(TransformKind kind, size_t size, size_t batchCount = 1) {
+    std::lock_guard<std::mutex> lock(this->planningMutex);
+
+    auto key = std::make_tuple(kind, size, batchCount);
+    auto found = this->plans.find(key);
+    if (found != this->plans.end())
+      return found->second;
+
+    auto plan = this->createPlan(kind, size, batchCount);
+    this->plans.emplace(key, plan);
+
+    // Saving wisdom only when something new was planned
+    if (!FFTW::exportWisdom()) {
+      throw std::runtime_error("FFTW3 error: Couldn't save wisdom to file");
+    }
+
+    return plan;
+  }
+
+ private:
+  static Plan createPlan(TransformKind kind, size_t size, size_t batchCount) {
+    Plan plan = NULL;
+    int transformSize = static_cast<int>(size);
+    int rows = static_cast<int>(batchCount);
+
+    // Planning with FFTW_PATIENT overwrites the arrays, so it's done over scratch ones
+    if (kind == TransformKind::RealForward) {
+      int outputSize = transformSize / 2 + 1;
+      Sample* input = FFTW::allocReal(size * batchCount);
+      auto output = FFTW::allocComplex(outputSize * batchCount);
+      if (batchCount == 1)
+        plan = FFTW::planDftR2C(transformSize, input, output, planningFlags);
+      else
+        plan = FFTW::planManyDftR2C(
+            transformSize, rows, input, transformSize, output, outputSize, planningFlags
+        );
+      FFTW::free(input);
+      FFTW::free(output);
+
+      if (plan == NULL)
+        throw std::runtime_error("FFTW3 error: Couldn't make plans for FFT");
+    } else {
+      Sample* input = FFTW::allocReal(size * batchCount);
+      Sample* output = FFTW::allocReal(size * batchCount);
+      if (batchCount == 1)
+        plan = FFTW::planR2R(transformSize, input, output, FFTW_REDFT10, planningFlags);
+      else
+        plan = FFTW::planManyR2R(transformSize, rows, input, output, FFTW_REDFT10, planningFlags);
+      FFTW::free(input);
+      FFTW::free(output);
+
+      if (plan == NULL)
+        throw std::runtime_error("FFTW3 error: Couldn't make plans for DCT");
+    }
+
+    return plan;
+  }
+};
+
+}
+
+#endif //DICTAWAV_FFTWPLANREGISTRY_H
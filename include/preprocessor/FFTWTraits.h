@@ -0,0 +1,112 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 07/02/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_FFTWTRAITS_H
+#define DICTAWAV_FFTWTRAITS_H
+
+#include <cstddef>
+#include <fftw3.h>
+
+namespace DictaWav {
+
+// Maps a sample type to its FFTW flavour, double uses libfftw3 and float uses libfftw3f.
+// Each precision has its own wisdom, so each one keeps it on a different file
+template<typename Sample>
+struct FFTWTraits;
+
+template<>
+struct FFTWTraits<double> {
+  using Plan = fftw_plan;
+  using Complex = fftw_complex;
+  using R2RKind = fftw_r2r_kind;
+
+  static constexpr const char* wisdomFileName = "./fftWisdomFile.data";
+
+  static double* allocReal(size_t size) { return fftw_alloc_real(size); }
+  static Complex* allocComplex(size_t size) { return fftw_alloc_complex(size); }
+  static void free(void* data) { fftw_free(data); }
+
+  static Plan planDftR2C(int size, double* input, Complex* output, unsigned flags) {
+    return fftw_plan_dft_r2c_1d(size, input, output, flags);
+  }
+  static Plan planManyDftR2C(
+      int size, int rows, double* input, int inputDistance, Complex* output, int outputDistance,
+      unsigned flags
+  ) {
+    return fftw_plan_many_dft_r2c(1, &size, rows, input, NULL, 1, inputDistance,
+                                  output, NULL, 1, outputDistance, flags);
+  }
+  static Plan planR2R(int size, double* input, double* output, R2RKind kind, unsigned flags) {
+    return fftw_plan_r2r_1d(size, input, output, kind, flags);
+  }
+  static Plan planManyR2R(
+      int size, int rows, double* input, double* output, R2RKind kind, unsigned flags
+  ) {
+    return fftw_plan_many_r2r(1, &size, rows, input, NULL, 1, size,
+                              output, NULL, 1, size, &kind, flags);
+  }
+
+  static void executeDftR2C(Plan plan, double* input, Complex* output) {
+    fftw_execute_dft_r2c(plan, input, output);
+  }
+  static void executeR2R(Plan plan, double* input, double* output) {
+    fftw_execute_r2r(plan, input, output);
+  }
+  static void destroyPlan(Plan plan) { fftw_destroy_plan(plan); }
+
+  static int importWisdom() { return fftw_import_wisdom_from_filename(wisdomFileName); }
+  static int exportWisdom() { return fftw_export_wisdom_to_filename(wisdomFileName); }
+};
+
+template<>
+struct FFTWTraits<float> {
+  using Plan = fftwf_plan;
+  using Complex = fftwf_complex;
+  using R2RKind = fftwf_r2r_kind;
+
+  static constexpr const char* wisdomFileName = "./fftwfWisdomFile.data";
+
+  static float* allocReal(size_t size) { return fftwf_alloc_real(size); }
+  static Complex* allocComplex(size_t size) { return fftwf_alloc_complex(size); }
+  static void free(void* data) { fftwf_free(data); }
+
+  static Plan planDftR2C(int size, float* input, Complex* output, unsigned flags) {
+    return fftwf_plan_dft_r2c_1d(size, input, output, flags);
+  }
+  static Plan planManyDftR2C(
+      int size, int rows, float* input, int inputDistance, Complex* output, int outputDistance,
+      unsigned flags
+  ) {
+    return fftwf_plan_many_dft_r2c(1, &size, rows, input, NULL, 1, inputDistance,
+                                   output, NULL, 1, outputDistance, flags);
+  }
+  static Plan planR2R(int size, float* input, float* output, R2RKind kind, unsigned flags) {
+    return fftwf_plan_r2r_1d(size, input, output, kind, flags);
+  }
+  static Plan planManyR2R(
+      int size, int rows, float* input, float* output, R2RKind kind, unsigned flags
+  ) {
+    return fftwf_plan_many_r2r(1, &size, rows, input, NULL, 1, size,
+                               output, NULL, 1, size, &kind, flags);
+  }
+
+  static void executeDftR2C(Plan plan, float* input, Complex* output) {
+    fftwf_execute_dft_r2c(plan, input, output);
+  }
+  static void executeR2R(Plan plan, float* input, float* output) {
+    fftwf_execute_r2r(plan, input, output);
+  }
+  static void destroyPlan(Plan plan) { fftwf_destroy_plan(plan); }
+
+  static int importWisdom() { return fftwf_import_wisdom_from_filename(wisdomFileName); }
+  static int exportWisdom() { return fftwf_export_wisdom_to_filename(wisdomFileName); }
+};
+
+}
+
+#endif //DICTAWAV_FFTWTRAITS_H
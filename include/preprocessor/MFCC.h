@@ -11,19 +11,27 @@
 
 #include <cmath>
 #include <vector>
-#include <array>
 #include "DCTHandler.h"
+#include "SimdKernels.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
 class MFCC {
   size_t filterBanksCount;
   size_t sampleRate;
   size_t frameSize;
   double lowestFrequency;
   double highestFrequency;
-  DCTHandler dctHandler;
-  std::vector<std::array<size_t, 3>> filterBanks;
+  DCTHandler<Sample> dctHandler;
+
+  // Filter banks as a banded sparse matrix, filter i weights spectrum bins from
+  // filterFirstBins[i] to filterFirstBins[i] + filterLengths[i], with its weights stored
+  // contiguously on filterWeights, starting from filterWeightsOffsets[i]
+  std::vector<size_t> filterFirstBins;
+  std::vector<size_t> filterLengths;
+  std::vector<size_t> filterWeightsOffsets;
+  std::vector<Sample> filterWeights;
 
  public:
   MFCC(
@@ -31,43 +39,69 @@ class MFCC {
       size_t sampleRate,
       size_t frameLength,
       double lowerFrequency,
-      double higherFrequency
+      double higherFrequency,
+      size_t batchSize = 1
   ) :
       filterBanksCount(filterBanksCount),
       sampleRate(sampleRate),
       frameSize(frameLength),
       lowestFrequency(lowerFrequency),
       highestFrequency(higherFrequency),
-      dctHandler(filterBanksCount) {
-    this->filterBanks.reserve(filterBanksCount);
+      dctHandler(filterBanksCount, batchSize) {
+    this->filterFirstBins.reserve(filterBanksCount);
+    this->filterLengths.reserve(filterBanksCount);
+    this->filterWeightsOffsets.reserve(filterBanksCount);
     this->createFilterBanks();
   }
 
-  std::vector<double> compute(const std::vector<double>& frame) {
-    std::vector<double> filteredValues(this->filterBanksCount);
-
-    int currentFilter = 0;
-    for (const auto& filterBank : this->filterBanks) {
-      auto begin = filterBank[0];
-      auto mid = filterBank[1];
-      auto end = filterBank[2];
+  size_t getCoefficientsCount() const { return this->filterBanksCount / 2; }
 
-      for (auto pos = begin; pos != mid; ++pos)
-        filteredValues[currentFilter] +=
-            frame[pos] * static_cast<double>(pos - begin) / static_cast<double>(mid - begin);
-      for (auto pos = mid; pos != end; ++pos)
-        filteredValues[currentFilter] +=
-            frame[pos] * static_cast<double>(end - pos) / static_cast<double>(end - mid);
+  // Writes getCoefficientsCount() values on coefficients
+  void compute(const Sample* spectrum, Sample* coefficients) {
+    this->applyFilterBanks(spectrum, this->dctHandler.getInput());
+    this->dctHandler.process(coefficients);
+  }
 
-      ++currentFilter;
-    }
-    for (int pos = 0; pos != this->filterBanksCount; ++pos)
+  // Computes coefficients for rowsCount spectra laid out contiguously, spectrumSize values apart,
+  // writing getCoefficientsCount() values per spectrum on coefficients, with a single DCT call
+  void computeBatch(
+      const Sample* spectra,
+      size_t spectrumSize,
+      size_t rowsCount,
+      Sample* coefficients
+  ) {
+    // DCT batch input rows are contiguous, so they're filled as a single matrix
+    auto filteredValues = this->dctHandler.getBatchInput(0);
+
+    for (size_t filter = 0; filter != this->filterBanksCount; ++filter)
+      dotProductRows(
+          this->filterWeights.data() + this->filterWeightsOffsets[filter],
+          this->filterLengths[filter],
+          spectra + this->filterFirstBins[filter],
+          spectrumSize,
+          rowsCount,
+          filteredValues + filter,
+          this->filterBanksCount
+      );
+
+    for (size_t pos = 0; pos != rowsCount * this->filterBanksCount; ++pos)
       filteredValues[pos] = std::log(filteredValues[pos]);
 
-    return this->dctHandler.process(filteredValues);
+    this->dctHandler.processBatch(rowsCount, coefficients);
   }
 
  private:
+  // Writes the log energy of each filter bank on filteredValues
+  void applyFilterBanks(const Sample* frame, Sample* filteredValues) {
+    for (size_t filter = 0; filter != this->filterBanksCount; ++filter)
+      filteredValues[filter] = std::log(
+          dotProduct(
+              this->filterWeights.data() + this->filterWeightsOffsets[filter],
+              frame + this->filterFirstBins[filter],
+              this->filterLengths[filter]
+          ));
+  }
+
   void createFilterBanks() {
     double lowerMel = this->hertzToMels(this->lowestFrequency);
     double higherMel = this->hertzToMels(this->highestFrequency);
@@ -84,9 +118,23 @@ class MFCC {
               )));
     }
 
+    // Each filter is a triangle rising from bins[pos] to bins[pos + 1] and falling to bins[pos + 2],
+    // its weights are computed once here instead of on every frame
     for (size_t pos = 0; pos != this->filterBanksCount; ++pos) {
-      std::array<size_t, 3> currentFilterBank{bins[pos], bins[pos + 1], bins[pos + 2]};
-      this->filterBanks.push_back(currentFilterBank);
+      auto begin = bins[pos];
+      auto mid = bins[pos + 1];
+      auto end = bins[pos + 2];
+
+      this->filterFirstBins.push_back(begin);
+      this->filterLengths.push_back(end - begin);
+      this->filterWeightsOffsets.push_back(this->filterWeights.size());
+
+      for (auto bin = begin; bin != mid; ++bin)
+        this->filterWeights.push_back(static_cast<Sample>(
+            static_cast<double>(bin - begin) / static_cast<double>(mid - begin)));
+      for (auto bin = mid; bin != end; ++bin)
+        this->filterWeights.push_back(static_cast<Sample>(
+            static_cast<double>(end - bin) / static_cast<double>(end - mid)));
     }
   }
 
@@ -9,135 +9,204 @@
 #ifndef DICTA_PREPROCESSOR_H
 #define DICTA_PREPROCESSOR_H
 
-#include <queue>
 #include <cmath>
-#include <iostream>
-#include <memory>
+#include <algorithm>
+#include <stdexcept>
 #include "FFTHandler.h"
 #include "MFCC.h"
-
-using Frame = std::vector<double>;
+#include "SimdKernels.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
+using Frame = std::vector<Sample>;
+
+template<typename Sample = double>
 class PreProcessor {
   size_t samplesPerFrame;
-  std::vector<Frame> processedFrames;
-  FFTHandler fftHandler;
-  MFCC mfcc;
+  size_t hopSize;
+  size_t framesPerBatch;
+  FFTHandler<Sample> fftHandler;
+  std::vector<Sample> spectrum;
+  MFCC<Sample> mfcc;
+
+  // MFCC coefficients of every processed frame, one row after the other
+  std::vector<Sample> processedFeatures;
+
+  // Framing state, kept between chunks. The last samplesPerFrame samples live on a ring buffer,
+  // sample n being at position n & ringMask, and a new frame starts every hopSize samples
+  std::vector<Sample> ringBuffer;
+  size_t ringMask;
+  size_t receivedSamples = 0;
+  size_t nextFrameStart = 0;
+  std::vector<Sample> hannWindow;
+
+  // Batched mode state, frames are windowed straight into FFTHandler's batch matrix
+  size_t batchedFramesCount = 0;
+  std::vector<Sample> batchSpectra;
 
   static constexpr size_t filterBankCount = 26;
   static constexpr size_t lowestFrequency = 0;
   static constexpr double pi = 3.14159265358979323846;
 
  public:
-  explicit PreProcessor(size_t sampleRate) :
+  // Frames per FFTW call on batched mode, about 0.35s of audio at 44.1kHz
+  static constexpr size_t defaultFramesPerBatch = 32;
+
+  // With framesPerBatch greater than 1, frames are gathered on a contiguous matrix and
+  // transformed framesPerBatch at a time by a single FFT and a single DCT call, which lets FFTW
+  // vectorize across frames. Memory usage stays bounded by the batch size even on long audios
+  explicit PreProcessor(size_t sampleRate, size_t framesPerBatch = 1) :
       samplesPerFrame(getNextPowerOf2(sampleRate / 50)), // To get 20ms sized Frames
-      fftHandler(samplesPerFrame),
+      hopSize(samplesPerFrame / 2), // Frames overlap by half
+      framesPerBatch(framesPerBatch),
+      fftHandler(samplesPerFrame, FFTHandler<Sample>::SpectrumType::Magnitude, framesPerBatch),
+      spectrum(fftHandler.getSpectrumSize()),
       mfcc(
           filterBankCount,
           sampleRate,
           samplesPerFrame,
           lowestFrequency,
-          getHighestFrequency(sampleRate)
-      ) {}
-
-  void process(const std::vector<double>& audioData) {
-    auto frameMidPoint = this->samplesPerFrame / 2;
-
-    Frame firstFrame;
-    firstFrame.reserve(this->samplesPerFrame);
-
-    Frame secondFrame;
-    secondFrame.reserve(this->samplesPerFrame);
-
-    Frame thirdFrameFirstHalf;
-    thirdFrameFirstHalf.reserve(this->samplesPerFrame);
-
-    Frame thirdFrameComplete;
-    size_t sampleCounter = 0;
-
-    for (const auto sample : audioData) {
-      if (sampleCounter < frameMidPoint) {
-        if (!thirdFrameComplete.empty()) {
-          this->pushWindowedSample(sample, thirdFrameComplete);
-        }
-
-        this->pushWindowedSample(sample, firstFrame);
-      } else if (sampleCounter >= frameMidPoint && sampleCounter < this->samplesPerFrame) {
-        if (!thirdFrameComplete.empty() && thirdFrameComplete.size() == this->samplesPerFrame) {
-          this->processAndAddFrame(thirdFrameComplete);
-          thirdFrameComplete = std::move(Frame{}); // (this->samplesPerFrame);
-        }
-
-        this->pushWindowedSample(sample, firstFrame);
-        this->pushWindowedSample(sample, secondFrame);
-      } else {
-        this->pushWindowedSample(sample, secondFrame);
-        this->pushWindowedSample(sample, thirdFrameFirstHalf);
-      }
+          getHighestFrequency(sampleRate),
+          framesPerBatch
+      ),
+      ringBuffer(samplesPerFrame),
+      ringMask(samplesPerFrame - 1),
+      hannWindow(samplesPerFrame) {
+    if (framesPerBatch == 0)
+      throw std::runtime_error("PreProcessor error: Batches must have at least one frame");
+
+    if (framesPerBatch > 1)
+      this->batchSpectra =
+          std::vector<Sample>(framesPerBatch * this->fftHandler.getSpectrumSize());
+
+    // Window is computed once, frames are just multiplied by it
+    for (size_t index = 0; index != this->samplesPerFrame; ++index)
+      this->hannWindow[index] = static_cast<Sample>(this->hannWindowFunction(index));
+  }
 
-      if (thirdFrameFirstHalf.size() == frameMidPoint) {
-        thirdFrameComplete = std::move(thirdFrameFirstHalf);
-        thirdFrameFirstHalf = std::move(Frame{});
-        thirdFrameFirstHalf.reserve(this->samplesPerFrame);
-      }
+  void process(const std::vector<Sample>& audioData) {
+    this->processChunk(audioData.data(), audioData.size());
+    this->finish();
+  }
 
-      if (firstFrame.size() == this->samplesPerFrame) {
-        this->processAndAddFrame(firstFrame);
-        firstFrame = std::move(Frame{});
-        firstFrame.reserve(this->samplesPerFrame);
+  // Feeds a chunk of mono samples, frames are processed as soon as they are complete, so audio can
+  // be pushed incrementally while it's being decoded
+  void processChunk(const Sample* samples, size_t samplesCount) {
+    while (samplesCount != 0) {
+      // Copying samples up to the end of the next frame
+      auto missingSamples = this->nextFrameStart + this->samplesPerFrame - this->receivedSamples;
+      auto copiedSamples = std::min(missingSamples, samplesCount);
+      this->pushToRingBuffer(samples, copiedSamples);
+
+      samples += copiedSamples;
+      samplesCount -= copiedSamples;
+
+      if (copiedSamples == missingSamples) {
+        this->processAndAddFrame(this->nextFrameStart, this->samplesPerFrame);
+        this->nextFrameStart += this->hopSize;
       }
+    }
+  }
 
-      if (secondFrame.size() == this->samplesPerFrame) {
-        this->processAndAddFrame(secondFrame);
-        secondFrame = std::move(Frame{});
-        secondFrame.reserve(this->samplesPerFrame);
-      }
+  // Flushes remaining incomplete frames, must be called after the last chunk
+  void finish() {
+    // Adding remaining frames, padded with zeros
+    for (; this->nextFrameStart < this->receivedSamples; this->nextFrameStart += this->hopSize)
+      this->processAndAddFrame(
+          this->nextFrameStart,
+          this->receivedSamples - this->nextFrameStart
+      );
+    this->processBatch();
+
+    this->receivedSamples = 0;
+    this->nextFrameStart = 0;
+  }
 
-      if (sampleCounter > this->samplesPerFrame + frameMidPoint)
-        sampleCounter = 0;
-      else
-        ++sampleCounter;
-    }
+  size_t getCoefficientsCount() const { return this->mfcc.getCoefficientsCount(); }
 
-    // Adding remaining frames
-    this->checkFillAndAddIncompleteFrame(firstFrame);
-    this->checkFillAndAddIncompleteFrame(secondFrame);
-    this->checkFillAndAddIncompleteFrame(thirdFrameFirstHalf);
-    this->checkFillAndAddIncompleteFrame(thirdFrameComplete);
+  // All processed frames coefficients on a single matrix, getCoefficientsCount() values per frame
+  std::vector<Sample> extractProcessedFeatures() {
+    return std::move(this->processedFeatures);
   }
 
-  std::vector<Frame> extractProcessedFrames() {
-    return std::move(this->processedFrames);
+  std::vector<Frame<Sample>> extractProcessedFrames() {
+    auto coefficientsCount = this->mfcc.getCoefficientsCount();
+    std::vector<Frame<Sample>> processedFrames;
+    processedFrames.reserve(this->processedFeatures.size() / coefficientsCount);
+
+    for (auto frame = this->processedFeatures.cbegin();
+         frame != this->processedFeatures.cend();
+         frame += coefficientsCount)
+      processedFrames.emplace_back(frame, frame + coefficientsCount);
+
+    this->processedFeatures = std::vector<Sample>();
+    return processedFrames;
   }
 
-  void processAndAddFrame(Frame& frame) {
-    this->processedFrames.push_back(
-        this->mfcc.compute(
-            this->fftHandler.process(frame)
-        )
-    );
+  double hannWindowFunction(size_t index) {
+    return 0.5 * (1.0 - std::cos((2.0 * pi * index) / static_cast<double>(this->samplesPerFrame)));
   }
 
-  void pushWindowedSample(double sample, Frame& frame) {
-    auto length = frame.size();
-    frame.push_back(sample * this->hannWindowFunction(length));
+ private:
+  void pushToRingBuffer(const Sample* samples, size_t samplesCount) {
+    auto position = this->receivedSamples & this->ringMask;
+    auto untilEnd = std::min(samplesCount, this->samplesPerFrame - position);
+
+    std::copy(samples, samples + untilEnd, this->ringBuffer.begin() + position);
+    std::copy(samples + untilEnd, samples + samplesCount, this->ringBuffer.begin());
+
+    this->receivedSamples += samplesCount;
   }
 
-  void checkFillAndAddIncompleteFrame(Frame& frame) {
-    if (!frame.empty()) {
-      while (frame.size() < this->samplesPerFrame)
-        frame.push_back(0.0);
-      this->processAndAddFrame(frame);
+  // Windows the frame starting at sample frameStart into FFTHandler input, samples after
+  // availableSamples are taken as zeros, then runs it or queues it on the current batch
+  void processAndAddFrame(size_t frameStart, size_t availableSamples) {
+    Sample* frame = this->framesPerBatch > 1
+                    ? this->fftHandler.getBatchInput(this->batchedFramesCount)
+                    : this->fftHandler.getInput();
+
+    auto position = frameStart & this->ringMask;
+    auto untilEnd = std::min(availableSamples, this->samplesPerFrame - position);
+    const Sample* window = this->hannWindow.data();
+
+    multiply(this->ringBuffer.data() + position, window, frame, untilEnd);
+    multiply(this->ringBuffer.data(), window + untilEnd, frame + untilEnd,
+             availableSamples - untilEnd);
+    std::fill(frame + availableSamples, frame + this->samplesPerFrame, Sample(0));
+
+    if (this->framesPerBatch > 1) {
+      if (++this->batchedFramesCount == this->framesPerBatch)
+        this->processBatch();
+      return;
     }
+
+    this->fftHandler.process(this->spectrum.data());
+    this->mfcc.compute(this->spectrum.data(), this->appendFeatureRows(1));
   }
 
-  double hannWindowFunction(size_t index) {
-    return 0.5 * (1.0 - std::cos((2.0 * pi * index) / static_cast<double>(this->samplesPerFrame)));
+  void processBatch() {
+    if (this->batchedFramesCount == 0)
+      return;
+
+    this->fftHandler.processBatch(this->batchedFramesCount, this->batchSpectra.data());
+    this->mfcc.computeBatch(
+        this->batchSpectra.data(),
+        this->fftHandler.getSpectrumSize(),
+        this->batchedFramesCount,
+        this->appendFeatureRows(this->batchedFramesCount)
+    );
+
+    this->batchedFramesCount = 0;
+  }
+
+  // Grows features matrix by rowsCount frames, returning where the first new one begins
+  Sample* appendFeatureRows(size_t rowsCount) {
+    auto previousSize = this->processedFeatures.size();
+    this->processedFeatures.resize(previousSize + rowsCount * this->mfcc.getCoefficientsCount());
+    return this->processedFeatures.data() + previousSize;
   }
 
- private:
   constexpr size_t getNextPowerOf2(size_t num) {
     size_t base2 = 1;
     while (base2 <= num)
@@ -0,0 +1,284 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 09/02/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_SIMDKERNELS_H
+#define DICTAWAV_SIMDKERNELS_H
+
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace DictaWav {
+
+// Small vectorized kernels used by the preprocessing stages, instruction set is chosen at compile
+// time (AVX, SSE2 or plain C++). SimdVector wraps the registers of each sample type so kernels are
+// written only once
+
+template<typename Sample>
+struct SimdVector;
+
+#if defined(__AVX__)
+template<>
+struct SimdVector<double> {
+  using Register = __m256d;
+  static constexpr size_t width = 4;
+
+  static Register zero() { return _mm256_setzero_pd(); }
+  static Register load(const double* data) { return _mm256_loadu_pd(data); }
+  static void store(double* data, Register values) { _mm256_storeu_pd(data, values); }
+  static Register add(Register first, Register second) { return _mm256_add_pd(first, second); }
+  static Register multiply(Register first, Register second) { return _mm256_mul_pd(first, second); }
+  static Register broadcast(double value) { return _mm256_set1_pd(value); }
+  static Register subtract(Register first, Register second) { return _mm256_sub_pd(first, second); }
+  static Register divide(Register first, Register second) { return _mm256_div_pd(first, second); }
+  static Register minimum(Register first, Register second) { return _mm256_min_pd(first, second); }
+  static Register maximum(Register first, Register second) { return _mm256_max_pd(first, second); }
+  static double sum(Register values) {
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(values), _mm256_extractf128_pd(values, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+  }
+};
+
+template<>
+struct SimdVector<float> {
+  using Register = __m256;
+  static constexpr size_t width = 8;
+
+  static Register zero() { return _mm256_setzero_ps(); }
+  static Register load(const float* data) { return _mm256_loadu_ps(data); }
+  static void store(float* data, Register values) { _mm256_storeu_ps(data, values); }
+  static Register add(Register first, Register second) { return _mm256_add_ps(first, second); }
+  static Register multiply(Register first, Register second) { return _mm256_mul_ps(first, second); }
+  static Register broadcast(float value) { return _mm256_set1_ps(value); }
+  static Register subtract(Register first, Register second) { return _mm256_sub_ps(first, second); }
+  static Register divide(Register first, Register second) { return _mm256_div_ps(first, second); }
+  static Register minimum(Register first, Register second) { return _mm256_min_ps(first, second); }
+  static Register maximum(Register first, Register second) { return _mm256_max_ps(first, second); }
+  static float sum(Register values) {
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(values), _mm256_extractf128_ps(values, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+  }
+};
+#elif defined(__SSE2__)
+template<>
+struct SimdVector<double> {
+  using Register = __m128d;
+  static constexpr size_t width = 2;
+
+  static Register zero() { return _mm_setzero_pd(); }
+  static Register load(const double* data) { return _mm_loadu_pd(data); }
+  static void store(double* data, Register values) { _mm_storeu_pd(data, values); }
+  static Register add(Register first, Register second) { return _mm_add_pd(first, second); }
+  static Register multiply(Register first, Register second) { return _mm_mul_pd(first, second); }
+  static Register broadcast(double value) { return _mm_set1_pd(value); }
+  static Register subtract(Register first, Register second) { return _mm_sub_pd(first, second); }
+  static Register divide(Register first, Register second) { return _mm_div_pd(first, second); }
+  static Register minimum(Register first, Register second) { return _mm_min_pd(first, second); }
+  static Register maximum(Register first, Register second) { return _mm_max_pd(first, second); }
+  static double sum(Register values) {
+    return _mm_cvtsd_f64(_mm_add_sd(values, _mm_unpackhi_pd(values, values)));
+  }
+};
+
+template<>
+struct SimdVector<float> {
+  using Register = __m128;
+  static constexpr size_t width = 4;
+
+  static Register zero() { return _mm_setzero_ps(); }
+  static Register load(const float* data) { return _mm_loadu_ps(data); }
+  static void store(float* data, Register values) { _mm_storeu_ps(data, values); }
+  static Register add(Register first, Register second) { return _mm_add_ps(first, second); }
+  static Register multiply(Register first, Register second) { return _mm_mul_ps(first, second); }
+  static Register broadcast(float value) { return _mm_set1_ps(value); }
+  static Register subtract(Register first, Register second) { return _mm_sub_ps(first, second); }
+  static Register divide(Register first, Register second) { return _mm_div_ps(first, second); }
+  static Register minimum(Register first, Register second) { return _mm_min_ps(first, second); }
+  static Register maximum(Register first, Register second) { return _mm_max_ps(first, second); }
+  static float sum(Register values) {
+    values = _mm_add_ps(values, _mm_movehl_ps(values, values));
+    return _mm_cvtss_f32(_mm_add_ss(values, _mm_shuffle_ps(values, values, 1)));
+  }
+};
+#else
+// Without SIMD a register is a single sample
+template<typename Sample>
+struct SimdVector {
+  using Register = Sample;
+  static constexpr size_t width = 1;
+
+  static Register zero() { return Sample(0); }
+  static Register load(const Sample* data) { return *data; }
+  static void store(Sample* data, Register values) { *data = values; }
+  static Register add(Register first, Register second) { return first + second; }
+  static Register multiply(Register first, Register second) { return first * second; }
+  static Register broadcast(Sample value) { return value; }
+  static Register subtract(Register first, Register second) { return first - second; }
+  static Register divide(Register first, Register second) { return first / second; }
+  static Register minimum(Register first, Register second) { return std::min(first, second); }
+  static Register maximum(Register first, Register second) { return std::max(first, second); }
+  static Sample sum(Register values) { return values; }
+};
+#endif
+
+// Element wise product, output may alias any of the inputs
+template<typename Sample>
+inline void multiply(const Sample* first, const Sample* second, Sample* output, size_t size) {
+  using Simd = SimdVector<Sample>;
+  size_t pos = 0;
+
+  for (; pos + Simd::width <= size; pos += Simd::width)
+    Simd::store(output + pos, Simd::multiply(Simd::load(first + pos), Simd::load(second + pos)));
+
+  for (; pos != size; ++pos)
+    output[pos] = first[pos] * second[pos];
+}
+
+template<typename Sample>
+inline Sample dotProduct(const Sample* first, const Sample* second, size_t size) {
+  using Simd = SimdVector<Sample>;
+  size_t pos = 0;
+
+  auto sum = Simd::zero();
+  for (; pos + Simd::width <= size; pos += Simd::width)
+    sum = Simd::add(sum, Simd::multiply(Simd::load(first + pos), Simd::load(second + pos)));
+
+  Sample result = Simd::sum(sum);
+  for (; pos != size; ++pos)
+    result += first[pos] * second[pos];
+
+  return result;
+}
+
+// Dot products of weights against rowsCount rows, rowStride values apart, writing each one
+// resultStride values apart on results. Rows are taken four at a time so each weight load is
+// shared by four products, like a small matrix times vector product
+template<typename Sample>
+inline void dotProductRows(
+    const Sample* weights,
+    size_t size,
+    const Sample* rows,
+    size_t rowStride,
+    size_t rowsCount,
+    Sample* results,
+    size_t resultStride
+) {
+  using Simd = SimdVector<Sample>;
+  size_t row = 0;
+
+  for (; row + 4 <= rowsCount; row += 4) {
+    const Sample* row0 = rows + row * rowStride;
+    const Sample* row1 = row0 + rowStride;
+    const Sample* row2 = row1 + rowStride;
+    const Sample* row3 = row2 + rowStride;
+    auto sum0 = Simd::zero();
+    auto sum1 = Simd::zero();
+    auto sum2 = Simd::zero();
+    auto sum3 = Simd::zero();
+
+    size_t pos = 0;
+    for (; pos + Simd::width <= size; pos += Simd::width) {
+      auto weight = Simd::load(weights + pos);
+      sum0 = Simd::add(sum0, Simd::multiply(weight, Simd::load(row0 + pos)));
+      sum1 = Simd::add(sum1, Simd::multiply(weight, Simd::load(row1 + pos)));
+      sum2 = Simd::add(sum2, Simd::multiply(weight, Simd::load(row2 + pos)));
+      sum3 = Simd::add(sum3, Simd::multiply(weight, Simd::load(row3 + pos)));
+    }
+
+    Sample result0 = Simd::sum(sum0);
+    Sample result1 = Simd::sum(sum1);
+    Sample result2 = Simd::sum(sum2);
+    Sample result3 = Simd::sum(sum3);
+    for (; pos != size; ++pos) {
+      result0 += row0[pos] * weights[pos];
+      result1 += row1[pos] * weights[pos];
+      result2 += row2[pos] * weights[pos];
+      result3 += row3[pos] * weights[pos];
+    }
+
+    results[row * resultStride] = result0;
+    results[(row + 1) * resultStride] = result1;
+    results[(row + 2) * resultStride] = result2;
+    results[(row + 3) * resultStride] = result3;
+  }
+
+  for (; row != rowsCount; ++row)
+    results[row * resultStride] = dotProduct(weights, rows + row * rowStride, size);
+}
+
+// Rational approximation of tanh, a degree 13 odd polynomial over a degree 6 even one, evaluated
+// on inputs clamped to [-tanhClamp, tanhClamp], past which tanh is 1 on single precision. Results
+// stay within 4e-7 of std::tanh for both sample types
+template<typename Sample>
+inline typename SimdVector<Sample>::Register tanhApproximation(
+    typename SimdVector<Sample>::Register values
+) {
+  using Simd = SimdVector<Sample>;
+  constexpr Sample tanhClamp = Sample(7.90531110763549805);
+
+  auto x = Simd::maximum(Simd::broadcast(-tanhClamp),
+                         Simd::minimum(Simd::broadcast(tanhClamp), values));
+  auto x2 = Simd::multiply(x, x);
+  auto multiplyAdd = [](auto first, auto second, Sample third) {
+    return Simd::add(Simd::multiply(first, second), Simd::broadcast(third));
+  };
+
+  auto numerator = Simd::broadcast(Sample(-2.76076847742355e-16));
+  numerator = multiplyAdd(numerator, x2, Sample(2.00018790482477e-13));
+  numerator = multiplyAdd(numerator, x2, Sample(-8.60467152213735e-11));
+  numerator = multiplyAdd(numerator, x2, Sample(5.12229709037114e-08));
+  numerator = multiplyAdd(numerator, x2, Sample(1.48572235717979e-05));
+  numerator = multiplyAdd(numerator, x2, Sample(6.37261928875436e-04));
+  numerator = multiplyAdd(numerator, x2, Sample(4.89352455891786e-03));
+  numerator = Simd::multiply(numerator, x);
+
+  auto denominator = Simd::broadcast(Sample(1.19825839466702e-06));
+  denominator = multiplyAdd(denominator, x2, Sample(1.18534705686654e-04));
+  denominator = multiplyAdd(denominator, x2, Sample(2.26843463243900e-03));
+  denominator = multiplyAdd(denominator, x2, Sample(4.89352518554385e-03));
+
+  return Simd::divide(numerator, denominator);
+}
+
+// output = tanh((values - means) * scales) element wise, with tanhApproximation. Output may alias
+// values
+template<typename Sample>
+inline void scaledTanh(
+    const Sample* values,
+    const Sample* means,
+    const Sample* scales,
+    Sample* output,
+    size_t size
+) {
+  using Simd = SimdVector<Sample>;
+  size_t pos = 0;
+
+  for (; pos + Simd::width <= size; pos += Simd::width)
+    Simd::store(output + pos, tanhApproximation<Sample>(Simd::multiply(
+        Simd::subtract(Simd::load(values + pos), Simd::load(means + pos)),
+        Simd::load(scales + pos)
+    )));
+
+  // Remaining values go through a zero padded register, so they get the same approximation
+  if (pos != size) {
+    Sample last[Simd::width] = {};
+    for (size_t index = pos; index != size; ++index)
+      last[index - pos] = (values[index] - means[index]) * scales[index];
+
+    Simd::store(last, tanhApproximation<Sample>(Simd::load(last)));
+    std::copy(last, last + (size - pos), output + pos);
+  }
+}
+
+}
+
+#endif //DICTAWAV_SIMDKERNELS_H
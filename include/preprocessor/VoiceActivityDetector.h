@@ -0,0 +1,238 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 14/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_VOICEACTIVITYDETECTOR_H
+#define DICTAWAV_VOICEACTIVITYDETECTOR_H
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "SimdKernels.h"
+
+namespace DictaWav {
+
+// Endpointing stage meant to sit between WavHandler and PreProcessor. Audio is split on 10ms
+// frames, each one classified as speech by its short time energy and zero crossing rate, and only
+// speech frames are forwarded. Hangover keeps up to hangoverFrames frames of silence around speech,
+// so word onsets, endings and short pauses survive, longer silences are trimmed
+template<typename Sample = double>
+class VoiceActivityDetector {
+ private:
+  size_t frameLength;
+  size_t hangoverFrames;
+
+  // Frame being filled with incoming samples
+  std::vector<Sample> frame;
+  size_t frameFill = 0;
+
+  // Last silent frames, replayed if speech starts right after them. It's a ring of
+  // hangoverFrames slots, the oldest one at pendingHead
+  std::vector<Sample> pendingSamples;
+  size_t pendingHead = 0;
+  size_t pendingFrames = 0;
+
+  // Silent frames still forwarded after the last speech frame
+  size_t remainingHangover = 0;
+
+  // Noise energy follows quieter frames, thresholds are relative to it
+  double noiseEnergy = 0.0;
+  bool noiseInitialized = false;
+
+  // First frames, held until the noise floor starts at their lowest energy and then classified.
+  // Starting it at the first frame would put it at speech level on audio beginning with speech,
+  // trimming every frame as loud as it until a quieter one comes
+  std::vector<Sample> calibrationSamples;
+  size_t calibrationFramesCount = 0;
+
+  bool speechFound = false;
+  size_t framesCount = 0;
+  size_t trimmedFramesCount = 0;
+
+  // Speech is 6dB above the noise floor, or 3dB above it with a high zero crossing rate, which
+  // catches unvoiced fricatives. Frames under -60dBFS are always silence
+  static constexpr double speechEnergyRatio = 4.0;
+  static constexpr double unvoicedEnergyRatio = 2.0;
+  static constexpr double unvoicedZeroCrossingRate = 0.25;
+  static constexpr double minimumSpeechEnergy = 1e-6;
+  static constexpr double noiseAdaptationRate = 0.05;
+  // 100ms of audio before the first frame is classified
+  static constexpr size_t calibrationFrames = 10;
+
+ public:
+  // 80ms of hangover on each side of speech
+  static constexpr size_t defaultHangoverFrames = 8;
+
+  explicit VoiceActivityDetector(size_t sampleRate, size_t hangoverFrames = defaultHangoverFrames) :
+      frameLength(sampleRate / 100),
+      hangoverFrames(hangoverFrames),
+      frame(frameLength),
+      pendingSamples(frameLength * hangoverFrames),
+      calibrationSamples(frameLength * calibrationFrames) {
+    if (this->frameLength == 0)
+      throw std::runtime_error("VoiceActivityDetector error: Sample rate is too low");
+  }
+
+  // Feeds a chunk of mono samples, kept ones are handed to consumer(const Sample*, size_t) as soon
+  // as their frame is classified, so it can be chained to WavHandler::streamAudioData
+  template<typename Consumer>
+  void processChunk(const Sample* samples, size_t samplesCount, Consumer&& consumer) {
+    while (samplesCount != 0) {
+      auto copiedSamples = std::min(this->frameLength - this->frameFill, samplesCount);
+      std::copy(samples, samples + copiedSamples, this->frame.begin() + this->frameFill);
+
+      this->frameFill += copiedSamples;
+      samples += copiedSamples;
+      samplesCount -= copiedSamples;
+
+      if (this->frameFill == this->frameLength) {
+        this->processFrame(this->frameLength, consumer);
+        this->frameFill = 0;
+      }
+    }
+  }
+
+  // Classifies the last incomplete frame and drops trailing silence, must be called after the
+  // last chunk
+  template<typename Consumer>
+  void finish(Consumer&& consumer) {
+    this->endCalibration(consumer);
+    if (this->frameFill != 0)
+      this->processFrame(this->frameFill, consumer);
+
+    this->trimmedFramesCount += this->pendingFrames;
+    this->frameFill = 0;
+    this->pendingHead = 0;
+    this->pendingFrames = 0;
+    this->remainingHangover = 0;
+  }
+
+  // When no speech was found nothing was forwarded, callers should fallback to the whole audio
+  bool foundSpeech() const { return this->speechFound; }
+
+  size_t getFrameLength() const { return this->frameLength; }
+
+  size_t getFramesCount() const { return this->framesCount; }
+
+  size_t getTrimmedFramesCount() const { return this->trimmedFramesCount; }
+
+ private:
+  template<typename Consumer>
+  void processFrame(size_t length, Consumer& consumer) {
+    if (this->noiseInitialized) {
+      this->classifyFrame(this->frame.data(), length, consumer);
+      return;
+    }
+
+    std::copy(this->frame.begin(), this->frame.end(),
+              this->calibrationSamples.begin() + this->calibrationFramesCount * this->frameLength);
+    if (++this->calibrationFramesCount == calibrationFrames)
+      this->endCalibration(consumer);
+  }
+
+  template<typename Consumer>
+  void endCalibration(Consumer& consumer) {
+    if (this->noiseInitialized)
+      return;
+
+    this->noiseInitialized = true;
+    if (this->calibrationFramesCount == 0)
+      return;
+
+    this->noiseEnergy = frameEnergy(this->calibrationSamples.data(), this->frameLength);
+    for (size_t calibrationFrame = 1;
+         calibrationFrame != this->calibrationFramesCount;
+         ++calibrationFrame)
+      this->noiseEnergy = std::min(
+          this->noiseEnergy,
+          frameEnergy(this->calibrationSamples.data() + calibrationFrame * this->frameLength,
+                      this->frameLength)
+      );
+
+    for (size_t calibrationFrame = 0;
+         calibrationFrame != this->calibrationFramesCount;
+         ++calibrationFrame)
+      this->classifyFrame(this->calibrationSamples.data() + calibrationFrame * this->frameLength,
+                          this->frameLength,
+                          consumer);
+    this->calibrationFramesCount = 0;
+  }
+
+  template<typename Consumer>
+  void classifyFrame(const Sample* samples, size_t length, Consumer& consumer) {
+    ++this->framesCount;
+
+    if (this->isSpeech(samples, length)) {
+      this->speechFound = true;
+      this->remainingHangover = this->hangoverFrames;
+      this->flushPendingFrames(consumer);
+      consumer(samples, length);
+
+    } else if (this->remainingHangover != 0) {
+      --this->remainingHangover;
+      consumer(samples, length);
+
+    } else if (this->hangoverFrames == 0 || length != this->frameLength) {
+      ++this->trimmedFramesCount;
+
+    } else {
+      // Ring is full, so its oldest frame is silence far from any speech
+      if (this->pendingFrames == this->hangoverFrames) {
+        ++this->trimmedFramesCount;
+        --this->pendingFrames;
+        this->pendingHead = (this->pendingHead + 1) % this->hangoverFrames;
+      }
+
+      auto slot = (this->pendingHead + this->pendingFrames) % this->hangoverFrames;
+      std::copy(samples, samples + length,
+                this->pendingSamples.begin() + slot * this->frameLength);
+      ++this->pendingFrames;
+    }
+  }
+
+  template<typename Consumer>
+  void flushPendingFrames(Consumer& consumer) {
+    for (size_t pending = 0; pending != this->pendingFrames; ++pending) {
+      auto slot = (this->pendingHead + pending) % this->hangoverFrames;
+      consumer(static_cast<const Sample*>(this->pendingSamples.data() + slot * this->frameLength),
+               this->frameLength);
+    }
+
+    this->pendingHead = 0;
+    this->pendingFrames = 0;
+  }
+
+  static double frameEnergy(const Sample* samples, size_t length) {
+    return static_cast<double>(dotProduct(samples, samples, length)) / length;
+  }
+
+  bool isSpeech(const Sample* samples, size_t length) {
+    double energy = frameEnergy(samples, length);
+
+    size_t zeroCrossings = 0;
+    for (size_t index = 1; index < length; ++index)
+      zeroCrossings += (samples[index - 1] >= Sample(0)) != (samples[index] >= Sample(0));
+    double zeroCrossingRate = static_cast<double>(zeroCrossings) / length;
+
+    auto threshold = std::max(this->noiseEnergy * speechEnergyRatio, minimumSpeechEnergy);
+    bool speech = energy > threshold
+        || (energy > threshold * (unvoicedEnergyRatio / speechEnergyRatio)
+            && zeroCrossingRate > unvoicedZeroCrossingRate);
+
+    // Noise floor drops immediately to quieter frames and slowly rises on silent ones
+    if (energy < this->noiseEnergy)
+      this->noiseEnergy = energy;
+    else if (!speech)
+      this->noiseEnergy += (energy - this->noiseEnergy) * noiseAdaptationRate;
+
+    return speech;
+  }
+};
+
+}
+
+#endif //DICTAWAV_VOICEACTIVITYDETECTOR_H
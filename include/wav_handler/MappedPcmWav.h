@@ -0,0 +1,161 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 13/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_MAPPEDPCMWAV_H
+#define DICTAWAV_MAPPEDPCMWAV_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define DICTAWAV_HAS_MMAP 1
+#endif
+
+namespace DictaWav {
+
+// Memory maps canonical 16 bits PCM little endian wav files, parsing the RIFF header by itself and
+// exposing the interleaved samples without copying them. Any file it doesn't understand is left
+// unmapped, so callers can fallback to libsndfile
+class MappedPcmWav {
+ private:
+  void* mapping = nullptr;
+  size_t mappingSize = 0;
+  const int16_t* samples = nullptr;
+  size_t frames = 0;
+  size_t channelsCount = 0;
+  size_t sampleRate = 0;
+
+  static constexpr uint16_t pcmFormat = 0x0001;
+  static constexpr uint16_t extensibleFormat = 0xFFFE;
+
+ public:
+  explicit MappedPcmWav(const std::string& wavPath) {
+#if defined(DICTAWAV_HAS_MMAP) && defined(__BYTE_ORDER__) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    int fileDescriptor = ::open(wavPath.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+      return;
+
+    struct stat fileStatus{};
+    if (::fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0) {
+      this->mappingSize = static_cast<size_t>(fileStatus.st_size);
+      this->mapping = ::mmap(nullptr, this->mappingSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+      if (this->mapping == MAP_FAILED)
+        this->mapping = nullptr;
+      else
+        ::madvise(this->mapping, this->mappingSize, MADV_SEQUENTIAL);
+    }
+    ::close(fileDescriptor);
+
+    if (this->mapping != nullptr && !this->parseHeader())
+      this->unmap();
+#endif
+  }
+
+  ~MappedPcmWav() {
+    this->unmap();
+  }
+
+  // Deleted copy constructor and operator
+  MappedPcmWav(const MappedPcmWav&) = delete;
+  MappedPcmWav& operator=(const MappedPcmWav&) = delete;
+
+  bool isMapped() const { return this->samples != nullptr; }
+
+  size_t getSampleRate() const { return this->sampleRate; }
+
+  size_t getChannelsCount() const { return this->channelsCount; }
+
+  size_t getFramesCount() const { return this->frames; }
+
+  // Interleaved samples, valid while this object lives
+  const int16_t* getSamples() const { return this->samples; }
+
+ private:
+  void unmap() {
+#if defined(DICTAWAV_HAS_MMAP)
+    if (this->mapping != nullptr)
+      ::munmap(this->mapping, this->mappingSize);
+#endif
+    this->mapping = nullptr;
+    this->samples = nullptr;
+    this->frames = 0;
+  }
+
+  static uint16_t readUInt16(const unsigned char* data) {
+    uint16_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static uint32_t readUInt32(const unsigned char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  bool parseHeader() {
+    auto data = static_cast<const unsigned char*>(this->mapping);
+    auto size = this->mappingSize;
+
+    if (size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0)
+      return false;
+
+    bool foundFormat = false;
+    size_t position = 12;
+    while (position + 8 <= size) {
+      auto chunkId = data + position;
+      size_t chunkSize = readUInt32(data + position + 4);
+      auto chunkData = data + position + 8;
+      size_t available = size - position - 8;
+
+      if (std::memcmp(chunkId, "fmt ", 4) == 0) {
+        if (chunkSize < 16 || chunkSize > available)
+          return false;
+
+        auto format = readUInt16(chunkData);
+        // WAVE_FORMAT_EXTENSIBLE keeps the real format on the first bytes of its sub format GUID
+        if (format == extensibleFormat && chunkSize >= 26)
+          format = readUInt16(chunkData + 24);
+
+        this->channelsCount = readUInt16(chunkData + 2);
+        this->sampleRate = readUInt32(chunkData + 4);
+        auto blockAlign = readUInt16(chunkData + 12);
+        auto bitsPerSample = readUInt16(chunkData + 14);
+
+        if (format != pcmFormat || bitsPerSample != 16 || this->channelsCount == 0
+            || blockAlign != this->channelsCount * sizeof(int16_t) || this->sampleRate == 0)
+          return false;
+
+        foundFormat = true;
+      } else if (std::memcmp(chunkId, "data", 4) == 0) {
+        // Data before format or truncated files are left for libsndfile to deal with
+        if (!foundFormat || chunkSize > available || (position + 8) % alignof(int16_t) != 0)
+          return false;
+
+        this->frames = chunkSize / (this->channelsCount * sizeof(int16_t));
+        this->samples = reinterpret_cast<const int16_t*>(chunkData);
+        return this->frames != 0;
+      }
+
+      // Chunks are word aligned
+      position += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    return false;
+  }
+};
+
+}
+
+#endif //DICTAWAV_MAPPEDPCMWAV_H
@@ -0,0 +1,165 @@
+/*************************************************************\
+|-------------------------------------------------------------|
+|         Created by Ericson "Fogo" Soares on 13/03/17        |
+|-------------------------------------------------------------|
+|                 https://github.com/fogodev                  |
+|-------------------------------------------------------------|
+\*************************************************************/
+
+#ifndef DICTAWAV_PCMCONVERSION_H
+#define DICTAWAV_PCMCONVERSION_H
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace DictaWav {
+
+// Same normalization libsndfile applies when reading 16 bits PCM as floating point
+static constexpr double pcm16Scale = 1.0 / 32768.0;
+
+// Converts interleaved 16 bits PCM frames to normalized mono samples. Channels are summed as
+// integers before scaling, which is exact, so results match libsndfile's read followed by
+// averaging. There is one overload for each sample type of the pipeline
+inline void convertPcm16ToMono(
+    const int16_t* pcm,
+    size_t frames,
+    size_t channelsCount,
+    double* output
+) {
+  size_t frame = 0;
+
+  if (channelsCount == 1) {
+#if defined(__AVX2__)
+    const __m256d scale = _mm256_set1_pd(pcm16Scale);
+    for (; frame + 8 <= frames; frame += 8) {
+      __m256i samples = _mm256_cvtepi16_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + frame)));
+      _mm256_storeu_pd(output + frame,
+                       _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), scale));
+      _mm256_storeu_pd(output + frame + 4,
+                       _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)),
+                                     scale));
+    }
+#elif defined(__SSE2__)
+    const __m128d scale = _mm_set1_pd(pcm16Scale);
+    for (; frame + 4 <= frames; frame += 4) {
+      __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcm + frame));
+      // Sign extending 16 bits samples to 32 bits
+      samples = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+      _mm_storeu_pd(output + frame, _mm_mul_pd(_mm_cvtepi32_pd(samples), scale));
+      _mm_storeu_pd(output + frame + 2,
+                    _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(samples, 8)), scale));
+    }
+#endif
+    for (; frame != frames; ++frame)
+      output[frame] = static_cast<double>(pcm[frame]) * pcm16Scale;
+
+  } else if (channelsCount == 2) {
+    // Halving is folded into the scale, as both are powers of 2 the result is still exact
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256d scale = _mm256_set1_pd(pcm16Scale / 2.0);
+    for (; frame + 8 <= frames; frame += 8) {
+      // madd sums each left and right pair into a 32 bits integer
+      __m256i sums = _mm256_madd_epi16(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pcm + 2 * frame)), ones);
+      _mm256_storeu_pd(output + frame,
+                       _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sums)), scale));
+      _mm256_storeu_pd(output + frame + 4,
+                       _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sums, 1)), scale));
+    }
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128d scale = _mm_set1_pd(pcm16Scale / 2.0);
+    for (; frame + 4 <= frames; frame += 4) {
+      // madd sums each left and right pair into a 32 bits integer
+      __m128i sums = _mm_madd_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + 2 * frame)), ones);
+      _mm_storeu_pd(output + frame, _mm_mul_pd(_mm_cvtepi32_pd(sums), scale));
+      _mm_storeu_pd(output + frame + 2,
+                    _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(sums, 8)), scale));
+    }
+#endif
+    for (; frame != frames; ++frame)
+      output[frame] = (static_cast<double>(pcm[2 * frame]) * pcm16Scale
+          + static_cast<double>(pcm[2 * frame + 1]) * pcm16Scale) / 2.0;
+
+  } else {
+    for (; frame != frames; ++frame) {
+      double monoSample = 0.0;
+      for (size_t currentChannel = 0; currentChannel != channelsCount; ++currentChannel)
+        monoSample += static_cast<double>(pcm[frame * channelsCount + currentChannel]) * pcm16Scale;
+      output[frame] = monoSample / channelsCount;
+    }
+  }
+}
+
+inline void convertPcm16ToMono(
+    const int16_t* pcm,
+    size_t frames,
+    size_t channelsCount,
+    float* output
+) {
+  const float scale = static_cast<float>(pcm16Scale);
+  size_t frame = 0;
+
+  if (channelsCount == 1) {
+#if defined(__AVX2__)
+    const __m256 scales = _mm256_set1_ps(scale);
+    for (; frame + 8 <= frames; frame += 8) {
+      __m256i samples = _mm256_cvtepi16_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + frame)));
+      _mm256_storeu_ps(output + frame, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scales));
+    }
+#elif defined(__SSE2__)
+    const __m128 scales = _mm_set1_ps(scale);
+    for (; frame + 4 <= frames; frame += 4) {
+      __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pcm + frame));
+      // Sign extending 16 bits samples to 32 bits
+      samples = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+      _mm_storeu_ps(output + frame, _mm_mul_ps(_mm_cvtepi32_ps(samples), scales));
+    }
+#endif
+    for (; frame != frames; ++frame)
+      output[frame] = static_cast<float>(pcm[frame]) * scale;
+
+  } else if (channelsCount == 2) {
+    // A sum of two samples has at most 17 bits, which float represents exactly
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256 scales = _mm256_set1_ps(scale / 2.0f);
+    for (; frame + 8 <= frames; frame += 8) {
+      __m256i sums = _mm256_madd_epi16(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pcm + 2 * frame)), ones);
+      _mm256_storeu_ps(output + frame, _mm256_mul_ps(_mm256_cvtepi32_ps(sums), scales));
+    }
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128 scales = _mm_set1_ps(scale / 2.0f);
+    for (; frame + 4 <= frames; frame += 4) {
+      __m128i sums = _mm_madd_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + 2 * frame)), ones);
+      _mm_storeu_ps(output + frame, _mm_mul_ps(_mm_cvtepi32_ps(sums), scales));
+    }
+#endif
+    for (; frame != frames; ++frame)
+      output[frame] = (static_cast<float>(pcm[2 * frame]) * scale
+          + static_cast<float>(pcm[2 * frame + 1]) * scale) / 2.0f;
+
+  } else {
+    for (; frame != frames; ++frame) {
+      float monoSample = 0.0f;
+      for (size_t currentChannel = 0; currentChannel != channelsCount; ++currentChannel)
+        monoSample += static_cast<float>(pcm[frame * channelsCount + currentChannel]) * scale;
+      output[frame] = monoSample / channelsCount;
+    }
+  }
+}
+
+}
+
+#endif //DICTAWAV_PCMCONVERSION_H
@@ -12,38 +12,116 @@
 #include <string>
 #include <stdexcept>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <sndfile.hh>
+#include "MappedPcmWav.h"
+#include "PcmConversion.h"
 
 namespace DictaWav {
 
+template<typename Sample = double>
 class WavHandler {
  private:
   SndfileHandle wavInfo;
-  std::vector<double> audioData;
+  // Canonical 16 bits PCM files are read through a memory mapping, libsndfile handles the rest
+  std::unique_ptr<MappedPcmWav> mappedWav;
+  std::vector<Sample> audioData;
+  bool streaming;
 
  public:
-  explicit WavHandler(std::string wavPath) {
+  // Number of frames (samples per channel) pulled from libsndfile at each streaming step
+  static constexpr size_t defaultBlockFrames = 4096;
+
+  explicit WavHandler(std::string wavPath, bool streaming = false) : streaming(streaming) {
     this->setWavInfo(wavPath);
   }
   void setWavInfo(std::string wavPath) {
-    this->wavInfo = SndfileHandle(wavPath);
+    this->audioData = std::vector<Sample>();
+    this->mappedWav = std::make_unique<MappedPcmWav>(wavPath);
+
+    if (!this->mappedWav->isMapped()) {
+      this->mappedWav.reset();
+      this->wavInfo = SndfileHandle(wavPath);
+
+      if (this->wavInfo.error())
+        throw std::runtime_error("LibSndFile error: " + std::string(this->wavInfo.strError()));
+    }
 
-    if (this->wavInfo.error())
-      throw std::runtime_error("LibSndFile error: " + std::string(this->wavInfo.strError()));
+    // On streaming mode audio data is only decoded when streamAudioData is called
+    if (!this->streaming)
+      this->extractAudioData();
+  }
 
-    this->extractAudioData();
+  size_t getSampleRate() {
+    if (this->mappedWav)
+      return this->mappedWav->getSampleRate();
+    return this->wavInfo.samplerate();
   }
 
-  size_t getSampleRate() { return this->wavInfo.samplerate(); }
+  std::vector<Sample> getAudioData() { return std::move(this->audioData); }
+
+  // Decodes the wav file in blocks of blockFrames, converting each block to mono in place and
+  // handing it to consumer(const Sample* samples, size_t samplesCount), so memory usage is bounded
+  // by the block size instead of the file length
+  template<typename Consumer>
+  void streamAudioData(Consumer&& consumer, size_t blockFrames = defaultBlockFrames) {
+    if (this->mappedWav) {
+      this->streamMappedAudioData(consumer, blockFrames);
+      return;
+    }
+
+    auto channelsCount = static_cast<size_t>(this->wavInfo.channels());
+    std::vector<Sample> block(blockFrames * channelsCount);
+
+    sf_count_t readFrames;
+    sf_count_t totalReadFrames = 0;
+    while ((readFrames = this->wavInfo.readf(block.data(), blockFrames)) > 0) {
+      if (channelsCount > 1)
+        this->convertToMonoInPlace(block.data(), static_cast<size_t>(readFrames), channelsCount);
+
+      consumer(static_cast<const Sample*>(block.data()), static_cast<size_t>(readFrames));
+      totalReadFrames += readFrames;
+    }
+
+    if (totalReadFrames == 0)
+      throw std::runtime_error("LibSndFile error: Failed to read audio file.");
 
-  std::vector<double> getAudioData() { return std::move(this->audioData); }
+    if (totalReadFrames != this->wavInfo.frames())
+      throw std::runtime_error("LibSndFile error: Couldn't read all the frames on wav file.");
+  }
 
  private:
+  template<typename Consumer>
+  void streamMappedAudioData(Consumer& consumer, size_t blockFrames) {
+    auto frames = this->mappedWav->getFramesCount();
+    auto channelsCount = this->mappedWav->getChannelsCount();
+    auto samples = this->mappedWav->getSamples();
+    std::vector<Sample> block(blockFrames);
+
+    for (size_t frame = 0; frame < frames; frame += blockFrames) {
+      auto blockSize = std::min(blockFrames, frames - frame);
+      convertPcm16ToMono(samples + frame * channelsCount, blockSize, channelsCount, block.data());
+      consumer(static_cast<const Sample*>(block.data()), blockSize);
+    }
+  }
+
   void extractAudioData() {
+    if (this->mappedWav) {
+      this->audioData = std::vector<Sample>(this->mappedWav->getFramesCount());
+      convertPcm16ToMono(
+          this->mappedWav->getSamples(),
+          this->mappedWav->getFramesCount(),
+          this->mappedWav->getChannelsCount(),
+          this->audioData.data()
+      );
+      return;
+    }
+
     sf_count_t readFrames;
     auto audioDataSize = this->wavInfo.frames() * this->wavInfo.channels();
 
-    this->audioData = std::vector<double>(audioDataSize);
+    this->audioData = std::vector<Sample>(audioDataSize);
     readFrames = this->wavInfo.read(this->audioData.data(), audioDataSize);
 
     if (readFrames != audioDataSize)
@@ -60,15 +138,21 @@ class WavHandler {
     auto frames = this->wavInfo.frames();
     auto channelsCount = this->wavInfo.channels();
 
-    std::vector<double> monoAudio(frames);
+    this->convertToMonoInPlace(this->audioData.data(), frames, channelsCount);
+    this->audioData.resize(frames);
+    this->audioData.shrink_to_fit();
+  }
+
+  // Each mono sample is written at an index never greater than the ones still to be read,
+  // so interleaved samples can be averaged over the same buffer
+  static void convertToMonoInPlace(Sample* samples, size_t frames, size_t channelsCount) {
     for (size_t frame = 0; frame != frames; ++frame) {
+      Sample monoSample = Sample(0);
       for (size_t currentChannel = 0; currentChannel != channelsCount; ++currentChannel) {
-        monoAudio[frame] += this->audioData[frame * channelsCount + currentChannel];
+        monoSample += samples[frame * channelsCount + currentChannel];
       }
-      monoAudio[frame] /= channelsCount;
+      samples[frame] = monoSample / channelsCount;
     }
-
-    this->audioData = std::move(monoAudio);
   }
 };
 
@@ -3,12 +3,18 @@
 #include <unordered_set>
 #include <filesystem>
 #include <vector>
+#include <chrono>
 #include "../include/dictawav.h"
 
+using SearchMode = DictaWav::KernelCanvas<DictaWav::DefaultSample>::SearchMode;
+
 // KernelCanvas parameters
 const size_t kernelCanvasNumKernels = 2048;
 const size_t kernelCanvasKernelDimension = 13;
 const int kernelCanvasOutputFactor = 10;
+const SearchMode kernelCanvasSearchMode = SearchMode::Batched;
+// Only used by the Quantized search mode, which then also reports its disagreement rate
+const size_t kernelCanvasRerankCount = 8;
 
 // WiSARD parameters
 const size_t wisardRetinaSize = kernelCanvasNumKernels * kernelCanvasOutputFactor;
@@ -18,6 +24,16 @@ const double wisardConfidenceMinimumRate = 0.002;
 const unsigned wisardBleachingThreshold = 1;
 const bool wisardRandomizePositions = true;
 const bool wisardIsCumulative = true;
+const auto wisardStorage = DictaWav::Wisard::Storage::ClassInterleaved;
+const auto wisardRamBackend = DictaWav::RamBackend::OpenAddressing;
+const bool wisardProgressiveScoring = false;
+// Candidate pruning is only measured: a shortlist size other than 0 classifies every fold again
+// with pruning on, reporting how often it agrees with the full scoring and how long it takes.
+// Shortlists rank the votes of Wisard::defaultCoarseRamsCount RAMs
+const size_t wisardShortlistSize = 0;
+
+// Other parameters
+const bool trimSilence = false;
 
 double runTestsKfold(std::unordered_map<std::string,
                                         std::unordered_set<std::string>> classificationPaths);
@@ -80,7 +96,7 @@ int main(int argc, char** argv) {
 double runTestsKfold(std::unordered_map<std::string,
                                         std::unordered_set<std::string>> classificationPaths) {
 
-  DictaWav::DictaWav dictaWav{
+  DictaWav::DictaWav<DictaWav::DefaultSample> dictaWav{
       kernelCanvasNumKernels,
       kernelCanvasKernelDimension,
       kernelCanvasOutputFactor,
@@ -90,9 +106,21 @@ double runTestsKfold(std::unordered_map<std::string,
       wisardConfidenceMinimumRate,
       wisardBleachingThreshold,
       wisardRandomizePositions,
-      wisardIsCumulative
+      wisardIsCumulative,
+      trimSilence,
+      kernelCanvasSearchMode,
+      kernelCanvasRerankCount,
+      wisardStorage,
+      wisardRamBackend,
+      wisardProgressiveScoring
   };
 
+  auto& kernelCanvas = dictaWav.getKernelCanvas();
+  kernelCanvas.setDisagreementTracking(kernelCanvasSearchMode == SearchMode::Quantized);
+
+  auto& wisard = dictaWav.getWisard();
+  wisard.setProgressiveScoringTracking(wisardProgressiveScoring);
+
   auto totalWordsPerFold = classificationPaths.size();
 
   // 5 folds, each one with 1 path from each word
@@ -105,6 +133,11 @@ double runTestsKfold(std::unordered_map<std::string,
   };
 
   double summedAccuracy = 0.0;
+  double summedPrunedAccuracy = 0.0;
+  size_t classificationsCount = 0;
+  size_t agreementsCount = 0;
+  std::chrono::duration<double, std::milli> classificationTime{0};
+  std::chrono::duration<double, std::milli> prunedClassificationTime{0};
   auto numFolds = folds.size();
 
   for (const auto&[word, filePaths] : classificationPaths) {
@@ -127,22 +160,82 @@ double runTestsKfold(std::unordered_map<std::string,
       dictaWav.forget(filePath, word);
     }
 
-    size_t gotRight = 0;
+    // Files are painted once, so classification alone is timed
+    std::vector<std::string> testingWords;
+    std::vector<DictaWav::Retina> retinas;
     for (const auto&[word, filePath] : currentTestingFold) {
-      auto classification = dictaWav.classify(filePath);
-      if (word == classification)
-        ++gotRight;
+      testingWords.push_back(word);
+      retinas.push_back(dictaWav.paintRetina(filePath));
     }
 
+    // Progressive scoring settles retinas one at a time, batches score every class on every RAM
+    std::vector<std::string> classifications;
+    auto classificationStart = std::chrono::steady_clock::now();
+    if (wisardProgressiveScoring) {
+      for (const auto& retina : retinas)
+        classifications.push_back(wisard.classify(retina));
+    } else {
+      classifications = wisard.classifyBatch(retinas);
+    }
+    classificationTime += std::chrono::steady_clock::now() - classificationStart;
+    classificationsCount += retinas.size();
+
+    size_t gotRight = 0;
+    for (size_t index = 0; index != retinas.size(); ++index)
+      if (testingWords[index] == classifications[index])
+        ++gotRight;
+
     summedAccuracy += static_cast<double>(gotRight) / static_cast<double>(totalWordsPerFold);
 
+    // Through classificationAndProbability, as classify scores progressively when that's on
+    if (wisardShortlistSize != 0) {
+      wisard.setCandidatePruning(wisardShortlistSize);
+
+      size_t prunedGotRight = 0;
+      auto pruningStart = std::chrono::steady_clock::now();
+      for (size_t index = 0; index != retinas.size(); ++index) {
+        auto classification = wisard.classificationAndProbability(retinas[index]).first;
+        if (classification == classifications[index])
+          ++agreementsCount;
+        if (testingWords[index] == classification)
+          ++prunedGotRight;
+      }
+      prunedClassificationTime += std::chrono::steady_clock::now() - pruningStart;
+
+      summedPrunedAccuracy +=
+          static_cast<double>(prunedGotRight) / static_cast<double>(totalWordsPerFold);
+      wisard.setCandidatePruning(0);
+    }
+
     for (const auto&[word, filePath] : currentTestingFold) {
       dictaWav.train(filePath, word);
     }
   }
 
   double accuracy = summedAccuracy / static_cast<double>(numFolds);
-  std::cout << "Got " << accuracy * 100.0 << "% of accuracy" << std::endl;
+  std::cout << "Got " << accuracy * 100.0 << "% of accuracy, classifying "
+            << classificationsCount << " retinas in " << classificationTime.count() << "ms"
+            << std::endl;
+
+  if (wisardShortlistSize != 0)
+    std::cout << "Candidate pruning agreed with exhaustive scoring on "
+              << 100.0 * static_cast<double>(agreementsCount)
+                  / static_cast<double>(classificationsCount)
+              << "% of retinas, getting "
+              << 100.0 * summedPrunedAccuracy / static_cast<double>(numFolds)
+              << "% of accuracy in " << prunedClassificationTime.count() << "ms" << std::endl;
+
+  if (kernelCanvas.getApproximateSearchesCount() != 0)
+    std::cout << "Approximate kernel search disagreed with the exact one on "
+              << 100.0 * static_cast<double>(kernelCanvas.getDisagreementsCount())
+                  / static_cast<double>(kernelCanvas.getApproximateSearchesCount())
+              << "% of " << kernelCanvas.getApproximateSearchesCount() << " frames" << std::endl;
+
+  if (wisard.getClassifiedRamsCount() != 0)
+    std::cout << "Progressive scoring skipped "
+              << 100.0 * static_cast<double>(wisard.getSkippedRamsCount())
+                  / static_cast<double>(wisard.getClassifiedRamsCount())
+              << "% of " << wisard.getClassifiedRamsCount() << " RAM probes" << std::endl;
 
   return accuracy;
 }
\ No newline at end of file
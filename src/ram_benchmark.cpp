@@ -0,0 +1,120 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "../include/classificator/Discriminator.h"
+
+// Retina shaped like DictaWav's canvas: 2048 kernels replicated 10 times, about 60 of them active
+const size_t retinaBitsCount = 2048;
+const size_t retinaReplicas = 10;
+const size_t activeBitsCount = 60;
+
+// One discriminator trained like a class of a large vocabulary, then probed by unseen retinas
+const size_t trainingRetinasCount = 500;
+const size_t probingRetinasCount = 2000;
+
+std::vector<DictaWav::Retina> makeRetinas(size_t retinasCount, std::mt19937& randomEngine);
+
+void benchmark(
+    size_t ramNumBits,
+    DictaWav::RamBackend backend,
+    const std::string& backendName,
+    const std::vector<DictaWav::Retina>& trainingRetinas,
+    const std::vector<DictaWav::Retina>& probingRetinas
+);
+
+int main() {
+  std::mt19937 randomEngine(42);
+  auto trainingRetinas = makeRetinas(trainingRetinasCount, randomEngine);
+  auto probingRetinas = makeRetinas(probingRetinasCount, randomEngine);
+
+  std::cout << std::left << std::setw(6) << "bits" << std::setw(16) << "backend"
+            << std::setw(14) << "memory (KB)" << std::setw(16) << "insert (ns)"
+            << "probe (ns)" << std::endl;
+
+  for (size_t ramNumBits : {8, 12, 16, 24, 32}) {
+    benchmark(ramNumBits, DictaWav::RamBackend::HashMap, "HashMap",
+              trainingRetinas, probingRetinas);
+    benchmark(ramNumBits, DictaWav::RamBackend::OpenAddressing, "OpenAddressing",
+              trainingRetinas, probingRetinas);
+    if (ramNumBits <= DictaWav::DenseRamStorage::maximumNumBits)
+      benchmark(ramNumBits, DictaWav::RamBackend::Dense, "Dense", trainingRetinas, probingRetinas);
+  }
+
+  return 0;
+}
+
+std::vector<DictaWav::Retina> makeRetinas(size_t retinasCount, std::mt19937& randomEngine) {
+  // Active kernels cluster on a region of the canvas, like frames of similar sounds do
+  std::uniform_int_distribution<size_t> regionDistribution(0, retinaBitsCount - 1);
+  std::normal_distribution<double> offsetDistribution(0.0, 200.0);
+
+  std::vector<DictaWav::Retina> retinas;
+  retinas.reserve(retinasCount);
+  for (size_t index = 0; index != retinasCount; ++index) {
+    DictaWav::Retina retina(retinaBitsCount);
+    auto region = regionDistribution(randomEngine);
+    for (size_t bit = 0; bit != activeBitsCount; ++bit) {
+      auto offset = static_cast<long>(std::lround(offsetDistribution(randomEngine)));
+      retina.set((region + retinaBitsCount + offset % long(retinaBitsCount)) % retinaBitsCount);
+    }
+    retinas.push_back(std::move(retina));
+  }
+
+  return retinas;
+}
+
+void benchmark(
+    size_t ramNumBits,
+    DictaWav::RamBackend backend,
+    const std::string& backendName,
+    const std::vector<DictaWav::Retina>& trainingRetinas,
+    const std::vector<DictaWav::Retina>& probingRetinas
+) {
+  DictaWav::AddressMapping addressMapping(
+      retinaBitsCount * retinaReplicas,
+      ramNumBits,
+      true,
+      retinaReplicas
+  );
+  DictaWav::Discriminator discriminator(
+      addressMapping.getRetinaSize(),
+      ramNumBits,
+      addressMapping,
+      true,
+      backend
+  );
+
+  std::vector<DictaWav::RamAddresses> trainingAddresses;
+  for (const auto& retina : trainingRetinas)
+    trainingAddresses.push_back(addressMapping.computeAddresses(retina));
+  std::vector<DictaWav::RamAddresses> probingAddresses;
+  for (const auto& retina : probingRetinas)
+    probingAddresses.push_back(addressMapping.computeAddresses(retina));
+
+  auto trainingStart = std::chrono::steady_clock::now();
+  for (const auto& addresses : trainingAddresses)
+    discriminator.train(addresses);
+  auto trainingEnd = std::chrono::steady_clock::now();
+
+  // Votes are summed so probes can't be optimized away
+  size_t votes = 0;
+  auto probingStart = std::chrono::steady_clock::now();
+  for (const auto& addresses : probingAddresses)
+    for (auto count : discriminator.classify(addresses))
+      votes += count > 0;
+  auto probingEnd = std::chrono::steady_clock::now();
+
+  auto ramsCount = static_cast<double>(addressMapping.getRamsCount());
+  std::chrono::duration<double, std::nano> trainingTime = trainingEnd - trainingStart;
+  std::chrono::duration<double, std::nano> probingTime = probingEnd - probingStart;
+
+  std::cout << std::left << std::setw(6) << ramNumBits << std::setw(16) << backendName
+            << std::setw(14) << std::fixed << std::setprecision(1)
+            << discriminator.getMemoryUsage() / 1024.0
+            << std::setw(16) << trainingTime.count() / (ramsCount * trainingAddresses.size())
+            << probingTime.count() / (ramsCount * probingAddresses.size())
+            << (votes == 0 ? " (no votes)" : "") << std::endl;
+}